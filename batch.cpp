@@ -0,0 +1,222 @@
+// 多线程批量提取一个目录(或文件列表)里所有wav的音高
+// usage: swift_f0_batch [options] <model.onnx> <input dir | list.txt> <output dir> [workers]
+// 每个wav输出一个同名的.csv: time,pitch,confidence, 输入是目录时保留子目录结构
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "swift_f0_audio.hpp"
+#include "swift_f0_chunked.hpp"
+#ifdef SWIFT_F0_NATIVE
+#include "swift_f0_native.hpp"
+#else
+#include "swift_f0.hpp"
+#include "swift_f0_session_config.hpp"
+#endif
+
+#ifdef SWIFT_F0_NATIVE
+using Detector = qwqdsp::pitch::ChunkedPitchDetector<qwqdsp::pitch::NativePitchDetector>;
+#else
+using Detector = qwqdsp::pitch::ChunkedPitchDetector<qwqdsp::pitch::PitchDetector>;
+#endif
+
+constexpr size_t kChunkFrames = 2048;
+// 每次推理叠在一起的窗口数的默认值, --batch-size=N改变
+constexpr size_t kBatchSize = 1;
+constexpr float kSampleRate = 16000.0f;
+
+static std::vector<std::filesystem::path> CollectFiles(const std::filesystem::path& input) {
+    std::vector<std::filesystem::path> files;
+    if (std::filesystem::is_directory(input)) {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator{input}) {
+            auto ext = entry.path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(std::tolower(c)); });
+            if (entry.is_regular_file() && ext == ".wav") {
+                files.push_back(entry.path());
+            }
+        }
+        std::sort(files.begin(), files.end());
+    }
+    else {
+        // 每行一个路径
+        std::ifstream list{input};
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) files.emplace_back(line);
+        }
+    }
+    return files;
+}
+
+static bool WriteCsv(const std::filesystem::path& path, std::span<const float> pitch, std::span<const float> confidence) {
+    std::FILE* file = std::fopen(path.string().c_str(), "w");
+    if (file == nullptr) return false;
+    std::fprintf(file, "time,pitch,confidence\n");
+    for (size_t i = 0; i < pitch.size(); ++i) {
+        // 第i帧窗口的中心, 模型在前面补了kPadSize个0
+        float time = (i * Detector::kHopSize + Detector::kFFTSize / 2 - Detector::kPadSize) / kSampleRate;
+        std::fprintf(file, "%.4f,%.3f,%.5f\n", time, pitch[i], confidence[i]);
+    }
+    return std::fclose(file) == 0;
+}
+
+int main(int argc, char const *argv[]) {
+    std::vector<std::string_view> args;
+#ifndef SWIFT_F0_NATIVE
+    qwqdsp::pitch::SessionConfig session_config;
+#endif
+    size_t batch_size = kBatchSize;
+    bool bad_option = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg{argv[i]};
+        if (!arg.starts_with("--")) {
+            args.push_back(arg);
+            continue;
+        }
+        if (arg.starts_with("--batch-size=")) {
+            arg.remove_prefix(std::string_view{"--batch-size="}.size());
+            auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), batch_size);
+            if (ec == std::errc{} && end == arg.data() + arg.size() && batch_size > 0) continue;
+            std::printf("bad option %s\n", argv[i]);
+            bad_option = true;
+            continue;
+        }
+#ifndef SWIFT_F0_NATIVE
+        if (session_config.ParseArgument(arg)) continue;
+#endif
+        std::printf("bad option %s\n", argv[i]);
+        bad_option = true;
+    }
+    if (args.size() < 3 || bad_option) {
+        std::printf("usage: %s [options] <model.onnx> <input dir | list.txt> <output dir> [workers]\n"
+                    "  --batch-size=N\n", argv[0]);
+#ifndef SWIFT_F0_NATIVE
+        std::printf("%s", qwqdsp::pitch::SessionConfig::kUsage);
+#endif
+        return 1;
+    }
+    std::filesystem::path model_path{args[0]};
+    std::filesystem::path input{args[1]};
+    std::filesystem::path output_dir{args[2]};
+    const size_t num_cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t num_workers = args.size() > 3 ? std::strtoul(std::string{args[3]}.c_str(), nullptr, 10) : num_cores;
+    num_workers = std::max<size_t>(num_workers, 1);
+#ifndef SWIFT_F0_NATIVE
+    // 默认把核平分给worker, worker数>=核数时每个会话单线程, 不会超订
+    if (session_config.intra_op_threads == 0) {
+        session_config.intra_op_threads = static_cast<int>(std::max<size_t>(num_cores / num_workers, 1));
+    }
+    if (session_config.inter_op_threads == 0) {
+        session_config.inter_op_threads = 1;
+    }
+    // 多个会话共享核的时候, 空转等待只会抢别的worker的时间
+    if (session_config.intra_op_spinning == qwqdsp::pitch::SessionConfig::Switch::kDefault && session_config.intra_op_threads == 1) {
+        session_config.intra_op_spinning = qwqdsp::pitch::SessionConfig::Switch::kOff;
+    }
+#endif
+
+    const bool input_is_dir = std::filesystem::is_directory(input);
+    auto files = CollectFiles(input);
+    if (files.empty()) {
+        std::printf("no input files\n");
+        return 1;
+    }
+    num_workers = std::min(num_workers, files.size());
+    std::filesystem::create_directories(output_dir);
+
+#ifdef SWIFT_F0_NATIVE
+    qwqdsp::pitch::SwiftF0Weights weights;
+    if (!weights.Load(model_path)) {
+        std::printf("can not load %s\n", model_path.string().c_str());
+        return 1;
+    }
+#endif
+
+    std::atomic<size_t> next_file{0};
+    std::atomic<size_t> num_attempted{0};
+    std::atomic<size_t> num_failed{0};
+    std::atomic<size_t> num_failed_workers{0};
+    std::atomic<size_t> total_samples{0};
+    std::mutex print_lock;
+    // 异常不能离开线程, 否则std::terminate, 别的worker写了一半的csv也留在那里
+    auto worker = [&] {
+        Detector detector;
+        try {
+            detector.Init(kChunkFrames, batch_size);
+#ifdef SWIFT_F0_NATIVE
+            detector.GetDetector().Init(weights);
+#else
+            detector.GetDetector().Init(model_path.c_str(), detector.GetWindowSize(), batch_size,
+                                        session_config);
+#endif
+        }
+        catch (const std::exception& e) {
+            // 文件留给别的worker
+            ++num_failed_workers;
+            std::lock_guard lock{print_lock};
+            std::printf("worker init FAILED: %s\n", e.what());
+            return;
+        }
+
+        std::vector<float> input_data;
+        for (size_t i = next_file++; i < files.size(); i = next_file++) {
+            ++num_attempted;
+            const auto& path = files[i];
+            auto csv_path = output_dir / (input_is_dir ? path.lexically_relative(input) : path.filename());
+            csv_path.replace_extension(".csv");
+            std::error_code ec;
+            std::filesystem::create_directories(csv_path.parent_path(), ec);
+            std::string error;
+            bool ok = false;
+            try {
+                ok = qwqdsp::pitch::LoadAudio16k(path, input_data, false);
+                if (ok) {
+                    detector.Process(input_data);
+                    ok = WriteCsv(csv_path, detector.GetPitch(), detector.GetConfidence());
+                    total_samples += input_data.size();
+                }
+            }
+            catch (const std::exception& e) {
+                ok = false;
+                error = e.what();
+            }
+            if (!ok) {
+                std::filesystem::remove(csv_path, ec);
+                ++num_failed;
+                std::lock_guard lock{print_lock};
+                std::printf("%s: FAILED %s\n", path.string().c_str(), error.c_str());
+            }
+        }
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_workers; ++i) {
+        threads.emplace_back(worker);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double audio_seconds = total_samples / kSampleRate;
+    // 所有worker都初始化失败时, 没有处理的文件也算失败
+    num_failed += files.size() - num_attempted;
+
+    std::printf("files=%zu failed=%zu workers=%zu failed_workers=%zu audio=%.1fs time=%.1fs speed=%.1fx realtime\n",
+        files.size(), num_failed.load(), num_workers, num_failed_workers.load(), audio_seconds, elapsed,
+        audio_seconds / elapsed);
+    return num_failed == 0 && num_failed_workers == 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+// 分块推理时不同batch_size的吞吐量
+// usage: swift_f0_batch_bench [options] <model.onnx> <a.wav> [chunk_frames] [max_batch_size]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <vector>
+#include "swift_f0.hpp"
+#include "swift_f0_audio.hpp"
+#include "swift_f0_chunked.hpp"
+#include "swift_f0_session_config.hpp"
+
+// 每个batch_size跑几遍取最快的一次
+constexpr int kRepeats = 3;
+
+int main(int argc, char const *argv[]) {
+    std::vector<const char*> args;
+    qwqdsp::pitch::SessionConfig session_config;
+    bool bad_option = false;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-' || argv[i][1] != '-') {
+            args.push_back(argv[i]);
+        }
+        else if (!session_config.ParseArgument(argv[i])) {
+            std::printf("bad option %s\n", argv[i]);
+            bad_option = true;
+        }
+    }
+    if (args.size() < 2 || bad_option) {
+        std::printf("usage: %s [options] <model.onnx> <a.wav> [chunk_frames] [max_batch_size]\n%s",
+            argv[0], qwqdsp::pitch::SessionConfig::kUsage);
+        return 1;
+    }
+    std::filesystem::path model_path{args[0]};
+    size_t chunk_frames = args.size() > 2 ? std::strtoul(args[2], nullptr, 10) : 256;
+    size_t max_batch_size = args.size() > 3 ? std::strtoul(args[3], nullptr, 10) : 32;
+
+    std::vector<float> input_data;
+    if (!qwqdsp::pitch::LoadAudio16k(args[1], input_data)) {
+        std::printf("%s: can not load\n", args[1]);
+        return 1;
+    }
+
+    std::vector<float> reference_pitch;
+    std::vector<float> reference_confidence;
+    bool all_passed = true;
+    for (size_t batch_size = 1; batch_size <= max_batch_size; batch_size *= 2) {
+        qwqdsp::pitch::ChunkedPitchDetector<qwqdsp::pitch::PitchDetector> detector;
+        detector.Init(chunk_frames, batch_size);
+        detector.GetDetector().Init(model_path.c_str(), detector.GetWindowSize(), batch_size,
+                                    session_config);
+
+        double best = 1e30;
+        for (int i = 0; i < kRepeats; ++i) {
+            auto begin = std::chrono::steady_clock::now();
+            detector.Process(input_data);
+            auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double>(end - begin).count());
+        }
+
+        // 每个窗口的输出不受同一batch里其他窗口影响
+        auto pitch = detector.GetPitch();
+        auto confidence = detector.GetConfidence();
+        if (batch_size == 1) {
+            reference_pitch.assign(pitch.begin(), pitch.end());
+            reference_confidence.assign(confidence.begin(), confidence.end());
+        }
+        float max_error = 0;
+        for (size_t j = 0; j < detector.GetNumFrames(); ++j) {
+            max_error = std::max(max_error, std::abs(confidence[j] - reference_confidence[j]));
+            max_error = std::max(max_error, std::abs(pitch[j] - reference_pitch[j]) / reference_pitch[j]);
+        }
+        bool passed = detector.GetNumFrames() == reference_pitch.size() && max_error <= 1e-5f;
+        all_passed &= passed;
+
+        std::printf("batch=%zu frames=%zu time=%.1fms frames/s=%.0f max_error=%g%s\n",
+            batch_size, detector.GetNumFrames(), best * 1000.0, detector.GetNumFrames() / best,
+            max_error, passed ? "" : " FAILED");
+    }
+    return all_passed ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+// 对比onnxruntime和NativePitchDetector在一组音频上的输出
+// 还对比了onnxruntime输入SwiftF0FrontEnd算好的log|STFT|(InputType::kLogMagnitude)和输入音频的输出
+// 以及两者的Softmax(StreamingViterbi的输入)
+// 还有StreamingPitchDetector: 随机大小的块送进去再Flush(), 逐帧和onnxruntime比较
+// usage: swift_f0_compare <model.onnx> <a.wav> [b.wav ...]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <vector>
+#include "swift_f0.hpp"
+#include "swift_f0_audio.hpp"
+#include "swift_f0_frontend.hpp"
+#include "swift_f0_native.hpp"
+#include "swift_f0_stream.hpp"
+
+// 每一帧的confidence绝对误差
+constexpr float kConfidenceTolerance = 1e-4f;
+// confidence > kVoicedConfidence 的帧的pitch相对误差, 更低的置信度下峰值可能落在相邻的bin上
+constexpr float kPitchTolerance = 1e-4f;
+constexpr float kVoicedConfidence = 0.5f;
+// 流式输入的块大小在1...kMaxStreamBlock之间随机
+constexpr size_t kMaxStreamBlock = 4096;
+
+int main(int argc, char const *argv[]) {
+    if (argc < 3) {
+        std::printf("usage: %s <model.onnx> <a.wav> [b.wav ...]\n", argv[0]);
+        return 1;
+    }
+
+    std::filesystem::path model_path{argv[1]};
+    qwqdsp::pitch::NativePitchDetector native;
+    if (!native.Init(model_path)) {
+        std::printf("can not load %s\n", argv[1]);
+        return 1;
+    }
+    qwqdsp::pitch::SwiftF0FrontEnd front_end;
+    front_end.Init(model_path);
+    qwqdsp::pitch::StreamingPitchDetector streaming;
+    streaming.Init(model_path);
+    std::mt19937 rng{1};
+
+    bool all_passed = true;
+    for (int i = 2; i < argc; ++i) {
+        std::vector<float> input_data;
+        if (!qwqdsp::pitch::LoadAudio16k(argv[i], input_data)) {
+            std::printf("%s: can not load\n", argv[i]);
+            all_passed = false;
+            continue;
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        qwqdsp::pitch::PitchDetector ort;
+        ort.Init(model_path.c_str(), input_data.size(), 1, Ort::SessionOptions{},
+                 qwqdsp::pitch::PitchDetector::InputType::kAudio, true);
+        std::copy(input_data.begin(), input_data.end(), ort.GetInput().begin());
+        ort.Process();
+        auto ort_end = std::chrono::steady_clock::now();
+        native.Process(input_data);
+        auto native_end = std::chrono::steady_clock::now();
+
+        std::vector<float> log_magnitude(qwqdsp::pitch::SwiftF0FrontEnd::NumFrames(input_data.size())
+                                         * qwqdsp::pitch::SwiftF0FrontEnd::kNumFreqs);
+        front_end.Process(input_data, log_magnitude);
+        qwqdsp::pitch::PitchDetector ort_log_magnitude;
+        ort_log_magnitude.Init(model_path.c_str(), log_magnitude.size() / qwqdsp::pitch::SwiftF0FrontEnd::kNumFreqs, 1,
+                               Ort::SessionOptions{}, qwqdsp::pitch::PitchDetector::InputType::kLogMagnitude);
+        ort_log_magnitude.ProcessLogMagnitude(log_magnitude);
+
+        // 流式: 输出按帧号放好, 每一帧只能输出一次, 帧号连续
+        const size_t num_probabilities = qwqdsp::pitch::SwiftF0Weights::kNumPitchBins;
+        std::vector<float> stream_pitch(ort.GetNumFrames());
+        std::vector<float> stream_confidence(ort.GetNumFrames());
+        std::vector<float> stream_probabilities(ort.GetNumFrames() * num_probabilities);
+        size_t stream_frames = 0;
+        bool stream_in_order = true;
+        auto on_stream_frame = [&](size_t frame, float pitch, float confidence) {
+            stream_in_order &= frame == stream_frames && frame < stream_pitch.size();
+            if (frame < stream_pitch.size()) {
+                stream_pitch[frame] = pitch;
+                stream_confidence[frame] = confidence;
+                std::copy_n(streaming.GetProbabilities().begin(), num_probabilities,
+                            stream_probabilities.begin() + frame * num_probabilities);
+            }
+            ++stream_frames;
+        };
+        std::uniform_int_distribution<size_t> block_size{1, kMaxStreamBlock};
+        for (size_t pos = 0; pos < input_data.size();) {
+            const size_t n = std::min(block_size(rng), input_data.size() - pos);
+            streaming.Process(std::span<const float>{input_data.data() + pos, n}, on_stream_frame);
+            pos += n;
+        }
+        streaming.Flush(on_stream_frame);
+
+        float max_confidence_error = 0;
+        float max_pitch_error = 0;
+        size_t num_frames = ort.GetNumFrames();
+        // native和log|STFT|输入的结果都和onnxruntime输入音频的结果比较
+        auto compare = [&](std::span<const float> pitch, std::span<const float> confidence) {
+            for (size_t j = 0; j < num_frames; ++j) {
+                float ort_confidence = ort.GetConfidence()[j];
+                max_confidence_error = std::max(max_confidence_error, std::abs(ort_confidence - confidence[j]));
+                if (ort_confidence > kVoicedConfidence) {
+                    float ort_pitch = ort.GetPitch()[j];
+                    max_pitch_error = std::max(max_pitch_error, std::abs(ort_pitch - pitch[j]) / ort_pitch);
+                }
+            }
+        };
+        compare(native.GetPitch(), native.GetConfidence());
+        compare(ort_log_magnitude.GetPitch(), ort_log_magnitude.GetConfidence());
+        compare(stream_pitch, stream_confidence);
+        // Softmax每个bin的绝对误差, 和confidence用同一个容差
+        float max_probability_error = 0;
+        auto compare_probabilities = [&](std::span<const float> probabilities) {
+            if (probabilities.size() != ort.GetProbabilities().size()) return false;
+            for (size_t j = 0; j < probabilities.size(); ++j) {
+                max_probability_error = std::max(max_probability_error,
+                    std::abs(ort.GetProbabilities()[j] - probabilities[j]));
+            }
+            return true;
+        };
+        const bool probabilities_match = compare_probabilities(native.GetProbabilities())
+            && compare_probabilities(stream_probabilities);
+        bool passed = native.GetNumFrames() == num_frames
+            && ort_log_magnitude.GetNumFrames() == num_frames
+            && stream_in_order && stream_frames == num_frames
+            && probabilities_match
+            && max_confidence_error <= kConfidenceTolerance
+            && max_probability_error <= kConfidenceTolerance
+            && max_pitch_error <= kPitchTolerance;
+        all_passed &= passed;
+
+        std::printf("%s: %s frames=%zu stream_frames=%zu confidence_error=%g probability_error=%g pitch_error=%g ort=%.1fms native=%.1fms\n",
+            argv[i], passed ? "ok" : "FAILED", num_frames, stream_frames, max_confidence_error, max_probability_error, max_pitch_error,
+            std::chrono::duration<double, std::milli>(ort_end - begin).count(),
+            std::chrono::duration<double, std::milli>(native_end - ort_end).count());
+    }
+    return all_passed ? 0 : 1;
+}
@@ -11,12 +11,86 @@
 #ifndef SIGNALSMITH_ELLIPTIC_BLEP_H
 #define SIGNALSMITH_ELLIPTIC_BLEP_H
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <complex>
+#include <cstddef>
+#include <limits>
 #include <numbers>
+#include <tuple>
+#include <vector>
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <immintrin.h>
+#define SIGNALSMITH_BLEP_AVX2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SIGNALSMITH_BLEP_NEON 1
+#endif
 
 namespace signalsmith { namespace blep {
 
+namespace detail {
+/**
+ * @brief 复数极点按实部/虚部分开存(SoA), 一次处理kWidth个极点
+ *        float有AVX2(8个)和NEON(4个)的实现, 其他情况一次1个, 交给编译器
+ */
+template<class Sample>
+struct PoleVec {
+    static constexpr size_t kWidth = 1;
+    Sample v;
+    static PoleVec Load(const Sample* p) noexcept { return {*p}; }
+    static PoleVec Broadcast(Sample x) noexcept { return {x}; }
+    // a * b + c
+    static PoleVec MulAdd(PoleVec a, PoleVec b, PoleVec c) noexcept { return {a.v * b.v + c.v}; }
+    // c - a * b
+    static PoleVec NegMulAdd(PoleVec a, PoleVec b, PoleVec c) noexcept { return {c.v - a.v * b.v}; }
+    static PoleVec Mul(PoleVec a, PoleVec b) noexcept { return {a.v * b.v}; }
+    static PoleVec Add(PoleVec a, PoleVec b) noexcept { return {a.v + b.v}; }
+    static PoleVec Sub(PoleVec a, PoleVec b) noexcept { return {a.v - b.v}; }
+    void Store(Sample* p) const noexcept { *p = v; }
+    Sample Sum() const noexcept { return v; }
+};
+
+#if defined(SIGNALSMITH_BLEP_AVX2)
+template<>
+struct PoleVec<float> {
+    static constexpr size_t kWidth = 8;
+    __m256 v;
+    static PoleVec Load(const float* p) noexcept { return {_mm256_loadu_ps(p)}; }
+    static PoleVec Broadcast(float x) noexcept { return {_mm256_set1_ps(x)}; }
+    static PoleVec MulAdd(PoleVec a, PoleVec b, PoleVec c) noexcept { return {_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+    static PoleVec NegMulAdd(PoleVec a, PoleVec b, PoleVec c) noexcept { return {_mm256_fnmadd_ps(a.v, b.v, c.v)}; }
+    static PoleVec Mul(PoleVec a, PoleVec b) noexcept { return {_mm256_mul_ps(a.v, b.v)}; }
+    static PoleVec Add(PoleVec a, PoleVec b) noexcept { return {_mm256_add_ps(a.v, b.v)}; }
+    static PoleVec Sub(PoleVec a, PoleVec b) noexcept { return {_mm256_sub_ps(a.v, b.v)}; }
+    void Store(float* p) const noexcept { _mm256_storeu_ps(p, v); }
+    float Sum() const noexcept {
+        __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+        x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+        return _mm_cvtss_f32(x);
+    }
+};
+#elif defined(SIGNALSMITH_BLEP_NEON)
+template<>
+struct PoleVec<float> {
+    static constexpr size_t kWidth = 4;
+    float32x4_t v;
+    static PoleVec Load(const float* p) noexcept { return {vld1q_f32(p)}; }
+    static PoleVec Broadcast(float x) noexcept { return {vdupq_n_f32(x)}; }
+    static PoleVec MulAdd(PoleVec a, PoleVec b, PoleVec c) noexcept { return {vfmaq_f32(c.v, a.v, b.v)}; }
+    static PoleVec NegMulAdd(PoleVec a, PoleVec b, PoleVec c) noexcept { return {vfmsq_f32(c.v, a.v, b.v)}; }
+    static PoleVec Mul(PoleVec a, PoleVec b) noexcept { return {vmulq_f32(a.v, b.v)}; }
+    static PoleVec Add(PoleVec a, PoleVec b) noexcept { return {vaddq_f32(a.v, b.v)}; }
+    static PoleVec Sub(PoleVec a, PoleVec b) noexcept { return {vsubq_f32(a.v, b.v)}; }
+    void Store(float* p) const noexcept { vst1q_f32(p, v); }
+    float Sum() const noexcept { return vaddvq_f32(v); }
+};
+#endif
+}
+
 template<class TCoeffs, class Sample, size_t kPartialLUTSize>
 struct EllipticBlep {
     using Complex = std::complex<Sample>;
@@ -29,44 +103,63 @@ struct EllipticBlep {
     void SetCutoff(Sample cutoff) noexcept {
         Sample scale = cutoff / 20000;
 
-        auto addPole = [&](size_t index, Complex pole, Complex coeff, Complex impulseCoeff){
-            // Set up partial powers of the pole (so we can move forward/back by fractional samples)
+        // 补齐到kWidth的那几个极点和系数都是0, 状态一直是0
+        for (auto& partial : partial_step_) {
+            partial.re.fill(0);
+            partial.im.fill(0);
+        }
+        impulse_coeffs_.re.fill(0);
+        impulse_coeffs_.im.fill(0);
+
+        // Set up partial powers of the pole (so we can move forward/back by fractional samples)
+        const auto& realPoles = TCoeffs::realPoles;
+        const auto& realImpulseCoeffs = TCoeffs::realCoeffsDirect;
+        for (size_t i = 0; i < kNumReal; ++i) {
+            const Sample pole = realPoles[i] * scale * hz_to_omega_;
             for (size_t s = 0; s <= kPartialLUTSize; ++s) {
                 Sample partial = Sample(s) / kPartialLUTSize;
-                partial_step_poles_[s][index] = std::exp(partial * pole * hz_to_omega_);
+                real_partial_step_[s][i] = std::exp(partial * pole);
             }
-
             // Impulse coeffs are always direct
-            impluse_coeffs_[index] = impulseCoeff * hz_to_omega_;
-
-            // 这是为blep服务的，升频采样不需要它们
-            std::ignore = coeff;
-        };
-
-        // For now, just cast real poles to complex ones
-        const auto &realCoeffs = (TCoeffs::realCoeffsDirect);
-        const auto &realImpulseCoeffs = (TCoeffs::realCoeffsDirect);
-        for (size_t i = 0; i < TCoeffs::realCount; ++i) {
-            addPole(i, TCoeffs::realPoles[i] * scale, realCoeffs[i] * scale, realImpulseCoeffs[i] * scale);
+            real_impulse_coeffs_[i] = realImpulseCoeffs[i] * scale * hz_to_omega_;
+            poles_[i] = pole;
+            coeffs_[i] = real_impulse_coeffs_[i];
         }
-        const auto &complexCoeffs = (TCoeffs::complexCoeffsDirect);
-        const auto &complexImpulseCoeffs = (TCoeffs::complexCoeffsDirect);
-        for (size_t i = 0; i < TCoeffs::complexCount; ++i) {
-            addPole(i + TCoeffs::realCount, TCoeffs::complexPoles[i] * scale, complexCoeffs[i] * scale, complexImpulseCoeffs[i] * scale);
+        const auto& complexPoles = TCoeffs::complexPoles;
+        const auto& complexImpulseCoeffs = TCoeffs::complexCoeffsDirect;
+        for (size_t i = 0; i < kNumComplex; ++i) {
+            const Complex pole = complexPoles[i] * scale * hz_to_omega_;
+            for (size_t s = 0; s <= kPartialLUTSize; ++s) {
+                Sample partial = Sample(s) / kPartialLUTSize;
+                const Complex step = std::exp(partial * pole);
+                partial_step_[s].re[i] = step.real();
+                partial_step_[s].im[i] = step.imag();
+            }
+            const Complex coeff = complexImpulseCoeffs[i] * scale * hz_to_omega_;
+            impulse_coeffs_.re[i] = coeff.real();
+            impulse_coeffs_.im[i] = coeff.imag();
+            poles_[kNumReal + i] = pole;
+            coeffs_[kNumReal + i] = coeff;
         }
     }
     
     void Reset() {
-        for (auto &s : state_) s = 0;
+        state_.re.fill(0);
+        state_.im.fill(0);
+        real_state_.fill(0);
     }
     
     /// Instantaneous filter output
     Sample Get() const {
-        Sample sum = 0;
-        for (size_t i = 0; i < count; ++i) {
-            sum += state_[i].real();
+        Vec sum = Vec::Broadcast(0);
+        for (size_t i = 0; i < kComplexSize; i += kWidth) {
+            sum = Vec::Add(sum, Vec::Load(&state_.re[i]));
         }
-        return sum;
+        Sample result = sum.Sum();
+        for (size_t i = 0; i < kNumReal; ++i) {
+            result += real_state_[i];
+        }
+        return result;
     }
 
     /// Future (≤ 1 sample) filter output (as if we called `.step(samplesInFuture)` before `.get()`)
@@ -75,20 +168,37 @@ struct EllipticBlep {
         size_t intIndex = static_cast<size_t>(std::floor(tableIndex));
         Sample fracIndex = tableIndex - std::floor(tableIndex);
 
-        auto &lowPoles = partial_step_poles_[intIndex];
-        auto &highPoles = partial_step_poles_[intIndex + 1];
+        auto &low = partial_step_[intIndex];
+        auto &high = partial_step_[intIndex + 1];
 
-        Sample sum = 0;
-        for (size_t i = 0; i < count; ++i) {
-            Complex lerpPole = lowPoles[i] + (highPoles[i] - lowPoles[i])*fracIndex;
-            sum += (state_[i] * lerpPole).real();
+        // Re(state * lerp(low, high)) = state.re * pole.re - state.im * pole.im
+        const Vec frac = Vec::Broadcast(fracIndex);
+        Vec sum = Vec::Broadcast(0);
+        for (size_t i = 0; i < kComplexSize; i += kWidth) {
+            const Vec low_re = Vec::Load(&low.re[i]);
+            const Vec low_im = Vec::Load(&low.im[i]);
+            const Vec pole_re = Vec::MulAdd(Vec::Sub(Vec::Load(&high.re[i]), low_re), frac, low_re);
+            const Vec pole_im = Vec::MulAdd(Vec::Sub(Vec::Load(&high.im[i]), low_im), frac, low_im);
+            sum = Vec::MulAdd(Vec::Load(&state_.re[i]), pole_re, sum);
+            sum = Vec::NegMulAdd(Vec::Load(&state_.im[i]), pole_im, sum);
+        }
+        Sample result = sum.Sum();
+        auto &real_low = real_partial_step_[intIndex];
+        auto &real_high = real_partial_step_[intIndex + 1];
+        for (size_t i = 0; i < kNumReal; ++i) {
+            result += real_state_[i] * (real_low[i] + (real_high[i] - real_low[i]) * fracIndex);
         }
-        return sum;
+        return result;
     }
 
     void Add(Sample amount) {
-        for (size_t i = 0; i < count; ++i) {
-            state_[i] += amount * impluse_coeffs_[i];
+        const Vec a = Vec::Broadcast(amount);
+        for (size_t i = 0; i < kComplexSize; i += kWidth) {
+            Vec::MulAdd(a, Vec::Load(&impulse_coeffs_.re[i]), Vec::Load(&state_.re[i])).Store(&state_.re[i]);
+            Vec::MulAdd(a, Vec::Load(&impulse_coeffs_.im[i]), Vec::Load(&state_.im[i])).Store(&state_.im[i]);
+        }
+        for (size_t i = 0; i < kNumReal; ++i) {
+            real_state_[i] += amount * real_impulse_coeffs_[i];
         }
     }
     
@@ -98,18 +208,120 @@ struct EllipticBlep {
         Sample fracIndex = tableIndex - std::floor(tableIndex);
 
         // move the pulse along in time, the same way as state progresses in .step()
-        auto &lowPoles = partial_step_poles_[intIndex];
-        auto &highPoles = partial_step_poles_[intIndex + 1];
-        for (size_t i = 0; i < count; ++i) {
-            Complex lerpPole = lowPoles[i] + (highPoles[i] - lowPoles[i]) * fracIndex;
-            state_[i] += impluse_coeffs_[i] * lerpPole * amount;
+        auto &low = partial_step_[intIndex];
+        auto &high = partial_step_[intIndex + 1];
+        for (size_t i = 0; i < kNumComplex; ++i) {
+            Complex lerpPole = LerpPole(low, high, i, fracIndex);
+            Complex pulse = Complex{impulse_coeffs_.re[i], impulse_coeffs_.im[i]} * lerpPole * amount;
+            state_.re[i] += pulse.real();
+            state_.im[i] += pulse.imag();
+        }
+        auto &real_low = real_partial_step_[intIndex];
+        auto &real_high = real_partial_step_[intIndex + 1];
+        for (size_t i = 0; i < kNumReal; ++i) {
+            real_state_[i] += real_impulse_coeffs_[i] * (real_low[i] + (real_high[i] - real_low[i]) * fracIndex) * amount;
+        }
+    }
+
+    /**
+     * @brief 滤波器在0Hz的群延迟, 单位是采样
+     *        冲激响应h(t) = sum Re(c * exp(p * t)), 群延迟 = ∫t*h / ∫h = -Re(sum c / p^2) / Re(sum c / p)
+     *        通带内(相对截止频率很低的地方)基本是这个值
+     */
+    Sample GetGroupDelay() const noexcept {
+        Complex moment0{};
+        Complex moment1{};
+        for (size_t i = 0; i < kCount; ++i) {
+            moment0 += coeffs_[i] / poles_[i];
+            moment1 += coeffs_[i] / (poles_[i] * poles_[i]);
+        }
+        return -moment1.real() / moment0.real();
+    }
+
+    /**
+     * @brief 状态衰减到原来的tolerance倍以下要多少个采样: max|p|^n < tolerance
+     */
+    size_t GetSettleSamples(Sample tolerance) const noexcept {
+        // |p| = exp(Re(pole)), 实部都是负的
+        double slowest = -std::numeric_limits<double>::max();
+        for (size_t i = 0; i < kCount; ++i) {
+            slowest = std::max<double>(slowest, poles_[i].real());
         }
+        return static_cast<size_t>(std::ceil(std::log(static_cast<double>(tolerance)) / slowest));
     }
 
     void Step() {
-        const auto &poles = partial_step_poles_.back();
-        for (size_t i = 0; i < count; ++i) {
-            state_[i] *= poles[i];
+        const auto &poles = partial_step_.back();
+        for (size_t i = 0; i < kComplexSize; i += kWidth) {
+            const Vec state_re = Vec::Load(&state_.re[i]);
+            const Vec state_im = Vec::Load(&state_.im[i]);
+            const Vec pole_re = Vec::Load(&poles.re[i]);
+            const Vec pole_im = Vec::Load(&poles.im[i]);
+            Vec::NegMulAdd(state_im, pole_im, Vec::Mul(state_re, pole_re)).Store(&state_.re[i]);
+            Vec::MulAdd(state_im, pole_re, Vec::Mul(state_re, pole_im)).Store(&state_.im[i]);
+        }
+        const auto &real_poles = real_partial_step_.back();
+        for (size_t i = 0; i < kNumReal; ++i) {
+            real_state_[i] *= real_poles[i];
+        }
+    }
+
+    /**
+     * @brief 整数倍降采样用, StepDecimated()一次前进factor个采样
+     *        state = state * p^factor + sum_j x[j] * c * p^(factor - 1 - j), 和factor次Step(); Add(x[j])一样
+     *        每个输入只剩乘加, 复数乘法factor个输入才一次, 也不用插值的LUT
+     */
+    void SetDecimation(size_t factor) {
+        decimate_coeffs_.assign(factor, ComplexArray{});
+        real_decimate_coeffs_.assign(factor, RealArray{});
+        decimate_step_.re.fill(0);
+        decimate_step_.im.fill(0);
+        for (size_t i = 0; i < kNumReal; ++i) {
+            real_decimate_step_[i] = std::exp(static_cast<Sample>(factor) * poles_[i].real());
+            for (size_t j = 0; j < factor; ++j) {
+                real_decimate_coeffs_[j][i] = real_impulse_coeffs_[i]
+                                            * std::exp(static_cast<Sample>(factor - 1 - j) * poles_[i].real());
+            }
+        }
+        for (size_t i = 0; i < kNumComplex; ++i) {
+            const Complex pole = poles_[kNumReal + i];
+            const Complex step = std::exp(static_cast<Sample>(factor) * pole);
+            decimate_step_.re[i] = step.real();
+            decimate_step_.im[i] = step.imag();
+            for (size_t j = 0; j < factor; ++j) {
+                const Complex coeff = coeffs_[kNumReal + i] * std::exp(static_cast<Sample>(factor - 1 - j) * pole);
+                decimate_coeffs_[j].re[i] = coeff.real();
+                decimate_coeffs_[j].im[i] = coeff.imag();
+            }
+        }
+    }
+
+    /**
+     * @param x SetDecimation()的factor个输入
+     */
+    void StepDecimated(const Sample* x) {
+        const size_t factor = decimate_coeffs_.size();
+        for (size_t i = 0; i < kComplexSize; i += kWidth) {
+            const Vec state_re = Vec::Load(&state_.re[i]);
+            const Vec state_im = Vec::Load(&state_.im[i]);
+            const Vec pole_re = Vec::Load(&decimate_step_.re[i]);
+            const Vec pole_im = Vec::Load(&decimate_step_.im[i]);
+            Vec re = Vec::NegMulAdd(state_im, pole_im, Vec::Mul(state_re, pole_re));
+            Vec im = Vec::MulAdd(state_im, pole_re, Vec::Mul(state_re, pole_im));
+            for (size_t j = 0; j < factor; ++j) {
+                const Vec a = Vec::Broadcast(x[j]);
+                re = Vec::MulAdd(a, Vec::Load(&decimate_coeffs_[j].re[i]), re);
+                im = Vec::MulAdd(a, Vec::Load(&decimate_coeffs_[j].im[i]), im);
+            }
+            re.Store(&state_.re[i]);
+            im.Store(&state_.im[i]);
+        }
+        for (size_t i = 0; i < kNumReal; ++i) {
+            Sample state = real_state_[i] * real_decimate_step_[i];
+            for (size_t j = 0; j < factor; ++j) {
+                state += x[j] * real_decimate_coeffs_[j][i];
+            }
+            real_state_[i] = state;
         }
     }
 
@@ -123,28 +335,97 @@ struct EllipticBlep {
             intIndex -= kPartialLUTSize;
         }
 
-        auto &lowPoles = partial_step_poles_[intIndex];
-        auto &highPoles = partial_step_poles_[intIndex + 1];
+        auto &low = partial_step_[intIndex];
+        auto &high = partial_step_[intIndex + 1];
+        for (size_t i = 0; i < kNumComplex; ++i) {
+            Complex state = Complex{state_.re[i], state_.im[i]} * LerpPole(low, high, i, fracIndex);
+            state_.re[i] = state.real();
+            state_.im[i] = state.imag();
+        }
+        auto &real_low = real_partial_step_[intIndex];
+        auto &real_high = real_partial_step_[intIndex + 1];
+        for (size_t i = 0; i < kNumReal; ++i) {
+            real_state_[i] *= real_low[i] + (real_high[i] - real_low[i]) * fracIndex;
+        }
+    }
+
+private:
+    using Vec = detail::PoleVec<Sample>;
+    static constexpr size_t kWidth = Vec::kWidth;
+    static constexpr size_t kNumReal = TCoeffs::realCount;
+    static constexpr size_t kNumComplex = TCoeffs::complexCount;
+    static constexpr size_t kCount = kNumReal + kNumComplex;
+    // 复数极点补齐到kWidth的倍数, 整块整块地算
+    static constexpr size_t kComplexSize = (kNumComplex + kWidth - 1) / kWidth * kWidth;
+
+    // 复数极点的实部和虚部分开存, 实数极点单独存, 不当作虚部为0的复数
+    struct ComplexArray {
+        alignas(32) std::array<Sample, kComplexSize> re;
+        alignas(32) std::array<Sample, kComplexSize> im;
+    };
+    using RealArray = std::array<Sample, kNumReal>;
+public:
+    /**
+     * @brief 每个极点一个一阶递推, 状态是输入的线性函数
+     */
+    struct State {
+        ComplexArray complex{};
+        RealArray real{};
+    };
 
-        for (size_t i = 0; i < count; ++i) {
-            Complex lerpPole = lowPoles[i] + (highPoles[i] - lowPoles[i]) * fracIndex;
-            state_[i] *= lerpPole;
+    /**
+     * @brief 分块并行滤波时拼接状态: 块开始前的状态a经过n个采样(乘p^n), 加上这一块从0状态滤波得到的结束状态b
+     *        p^n直接用exp(n * pole)算, n很大时衰减到0
+     */
+    State Combine(const State& a, size_t n, const State& b) const {
+        State ret = b;
+        for (size_t i = 0; i < kNumReal; ++i) {
+            const double step = std::exp(static_cast<double>(n) * poles_[i].real());
+            ret.real[i] += static_cast<Sample>(a.real[i] * step);
         }
+        for (size_t i = 0; i < kNumComplex; ++i) {
+            const std::complex<double> step = std::exp(static_cast<double>(n) * std::complex<double>(poles_[kNumReal + i]));
+            const std::complex<double> state = std::complex<double>(a.complex.re[i], a.complex.im[i]) * step;
+            ret.complex.re[i] += static_cast<Sample>(state.real());
+            ret.complex.im[i] += static_cast<Sample>(state.imag());
+        }
+        return ret;
+    }
+
+    State GetState() const {
+        return {state_, real_state_};
     }
 
+    void SetState(const State& state) {
+        state_ = state.complex;
+        real_state_ = state.real;
+    }
 private:
-    // For now, just treat the real poles as complex ones
-    static constexpr size_t count = TCoeffs::complexCount + TCoeffs::realCount;
+    static Complex LerpPole(const ComplexArray& low, const ComplexArray& high, size_t i, Sample frac) noexcept {
+        return {low.re[i] + (high.re[i] - low.re[i]) * frac, low.im[i] + (high.im[i] - low.im[i]) * frac};
+    }
 
-    using Array = std::array<Complex, count>;
-    Array state_;
-    Array impluse_coeffs_;
+    ComplexArray state_;
+    ComplexArray impulse_coeffs_;
+    RealArray real_state_;
+    RealArray real_impulse_coeffs_;
+    // 每个采样的连续时间极点和冲激响应系数, 先实数后复数, 要精确: GetGroupDelay()用, SetDecimation()由它们算p^M和c * p^j,
+    // Combine()由它们算p^n, 不只是诊断用的
+    std::array<Complex, kCount> poles_;
+    std::array<Complex, kCount> coeffs_;
     Sample hz_to_omega_;
     
     // Lookup table for std::pow(pole, fractional)
-    std::array<Array, kPartialLUTSize + 1> partial_step_poles_;
+    std::array<ComplexArray, kPartialLUTSize + 1> partial_step_;
+    std::array<RealArray, kPartialLUTSize + 1> real_partial_step_;
+
+    // SetDecimation(): p^factor, 以及第j个输入的系数c * p^(factor - 1 - j)
+    ComplexArray decimate_step_;
+    RealArray real_decimate_step_;
+    std::vector<ComplexArray> decimate_coeffs_;
+    std::vector<RealArray> real_decimate_coeffs_;
 };
 
 }} // namespace
 
-#endif // include guard
\ No newline at end of file
+#endif // include guard
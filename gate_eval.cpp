@@ -0,0 +1,83 @@
+// 静音门限在一组音频上跳过的帧的比例, 以及丢掉的有声帧(和不加门限的推理结果比)
+// usage: swift_f0_gate_eval [options] <model.onnx> <a.wav> [b.wav ...]
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+#include "swift_f0.hpp"
+#include "swift_f0_audio.hpp"
+#include "swift_f0_frontend.hpp"
+#include "swift_f0_gate.hpp"
+#include "swift_f0_session_config.hpp"
+
+// 和main.cpp的kConfidence一样, 超过它算有声
+constexpr float kVoicedConfidence = 0.9f;
+
+int main(int argc, char const *argv[]) {
+    std::vector<const char*> args;
+    qwqdsp::pitch::SessionConfig session_config;
+    qwqdsp::pitch::GateConfig gate_config;
+    bool bad_option = false;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-' || argv[i][1] != '-') {
+            args.push_back(argv[i]);
+        }
+        else if (!session_config.ParseArgument(argv[i]) && !gate_config.ParseArgument(argv[i])) {
+            std::printf("bad option %s\n", argv[i]);
+            bad_option = true;
+        }
+    }
+    if (args.size() < 2 || bad_option) {
+        std::printf("usage: %s [options] <model.onnx> <a.wav> [b.wav ...]\n%s%s",
+            argv[0], qwqdsp::pitch::SessionConfig::kUsage, qwqdsp::pitch::GateConfig::kUsage);
+        return 1;
+    }
+    std::filesystem::path model_path{args[0]};
+
+    using FrontEnd = qwqdsp::pitch::SwiftF0FrontEnd;
+    FrontEnd front_end;
+    if (!front_end.Init(model_path)) {
+        std::printf("can not load %s\n", args[0]);
+        return 1;
+    }
+    qwqdsp::pitch::SilenceGate gate;
+    gate.Init(front_end.GetWindow(), gate_config);
+    qwqdsp::pitch::PitchDetector detector;
+    detector.Init(model_path.c_str(), 0, 1, session_config, qwqdsp::pitch::PitchDetector::InputType::kLogMagnitude);
+
+    qwqdsp::pitch::GateStats total;
+    bool all_loaded = true;
+    for (size_t i = 1; i < args.size(); ++i) {
+        std::vector<float> input_data;
+        if (!qwqdsp::pitch::LoadAudio16k(args[i], input_data)) {
+            std::printf("%s: can not load\n", args[i]);
+            all_loaded = false;
+            continue;
+        }
+
+        const size_t num_frames = FrontEnd::NumFrames(input_data.size());
+        std::vector<float> log_magnitude(num_frames * FrontEnd::kNumFreqs);
+        std::vector<char> silent(num_frames);
+        front_end.Process(input_data, log_magnitude, [&](size_t frame, std::span<const float> spectrum) {
+            silent[frame] = gate.IsSilent(spectrum);
+        });
+        // 不加门限的推理作为参考, 每一帧单独判断, 比realtime的4帧全部静音才跳过更激进
+        detector.ProcessLogMagnitude(log_magnitude);
+
+        qwqdsp::pitch::GateStats stats;
+        for (size_t j = 0; j < num_frames; ++j) {
+            stats.Add(silent[j], true, detector.GetConfidence()[j] > kVoicedConfidence);
+        }
+        stats.Print(args[i]);
+
+        total.num_frames += stats.num_frames;
+        total.num_skipped += stats.num_skipped;
+        total.num_voiced += stats.num_voiced;
+        total.num_lost += stats.num_lost;
+    }
+    if (total.num_frames == 0) {
+        return 1;
+    }
+    total.Print("total");
+    return all_loaded ? 0 : 1;
+}
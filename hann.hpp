@@ -0,0 +1,41 @@
+#pragma once
+#include <span>
+#include <cmath>
+#include <numbers>
+
+namespace qwqdsp::window {
+struct Hann {
+    // 和分析有关的
+    // f = width / N
+    static constexpr float kMainlobeWidth = 2.0f;
+    static constexpr float kSidelobe = -31.4686f;
+    static constexpr float kSidelobeRolloff = -18.0f;
+
+    /**
+     * @param for_analyze_not_fir true: 周期的窗, 和SwiftF0模型STFT用的一样
+     */
+    static void Window(std::span<float> x, bool for_analyze_not_fir) noexcept {
+        const size_t N = x.size();
+        if (for_analyze_not_fir) {
+            for (size_t n = 0; n < N; ++n) {
+                const float t = n / static_cast<float>(N) - 0.5f;
+                x[n] = 0.5f + 0.5f * std::cos(std::numbers::pi_v<float> * 2 * t);
+            }
+        }
+        else {
+            for (size_t n = 0; n < N; ++n) {
+                const float t = n / (N - 1.0f) - 0.5f;
+                x[n] = 0.5f + 0.5f * std::cos(std::numbers::pi_v<float> * 2 * t);
+            }
+        }
+    }
+
+    static void DWindow(std::span<float> x) noexcept {
+        const size_t N = x.size();
+        for (size_t n = 0; n < N; ++n) {
+            const float t = n / static_cast<float>(N) - 0.5f;
+            x[n] = -0.5f * std::numbers::pi_v<float> * 2 * std::sin(std::numbers::pi_v<float> * 2 * t);
+        }
+    }
+};
+}
@@ -1,10 +1,16 @@
-#include <onnxruntime_cxx_api.h>
 #include <raylib.h>
-#include "AudioFile.h"
-#include "slice.hpp"
-#include "oouras_real_fft.hpp"
-#include "resample_iir.hpp"
-#include "resample_coeffs.h"
+#include <charconv>
+#include <cstdio>
+#include <string_view>
+#include "swift_f0_audio.hpp"
+#include "swift_f0_chunked.hpp"
+#include "swift_f0_frontend.hpp"
+#ifdef SWIFT_F0_NATIVE
+#include "swift_f0_native.hpp"
+#else
+#include "swift_f0.hpp"
+#include "swift_f0_session_config.hpp"
+#endif
 
 Color GetSpectrumColor(float normal) {
     normal = fmaxf(0.0f, fminf(1.0f, normal));
@@ -32,99 +38,114 @@ constexpr float kSpectrumTopDb = 10.0f;
 constexpr int kWindowWidth = 1280;
 constexpr int kWindowHeight = 720;
 constexpr float kConfidence = 0.9f;
+// 每次推理输出的帧数, 推理的内存和它成正比而不是和文件长度
+constexpr size_t kChunkFrames = 2048;
+// front end每次算多少帧送进分块推理
+constexpr size_t kFrontEndFrames = 256;
+// 每次推理叠在一起的窗口数的默认值, --batch-size=N改变; 叠起来是否更快取决于机器, 见readme
+constexpr size_t kBatchSize = 1;
 
 constexpr auto kAudioPath = "../../working/mianjing2.wav";
 constexpr auto kModelPath = L"../../model.onnx";
-
-int main() {
-    // loading files
-    AudioFile<float> infile;
-    bool audio_file_loaded = infile.load(kAudioPath);
-    if (!audio_file_loaded) {
+// quantize.py生成, --int8选择它, 只有onnxruntime能运行
+constexpr auto kInt8ModelPath = L"../../model_int8.onnx";
+
+int main(int argc, char const *argv[]) {
+    size_t batch_size = kBatchSize;
+#ifndef SWIFT_F0_NATIVE
+    qwqdsp::pitch::SessionConfig session_config;
+    auto model_path = kModelPath;
+#endif
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg{argv[i]};
+        if (arg.starts_with("--batch-size=")) {
+            arg.remove_prefix(std::string_view{"--batch-size="}.size());
+            auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), batch_size);
+            if (ec == std::errc{} && end == arg.data() + arg.size() && batch_size > 0) continue;
+        }
+#ifndef SWIFT_F0_NATIVE
+        else if (arg == "--int8") {
+            model_path = kInt8ModelPath;
+            continue;
+        }
+        else if (session_config.ParseArgument(arg)) {
+            continue;
+        }
+        std::printf("bad option %s\n  --batch-size=N\n  --int8\n%s", argv[i], qwqdsp::pitch::SessionConfig::kUsage);
+#else
+        std::printf("bad option %s\n  --batch-size=N\n", argv[i]);
+#endif
         return 1;
     }
 
-    // resample
+    // loading files, resample to 16kHz
     std::vector<float> input_data;
-    if (infile.getSampleRate() != 16000) {
-        qwqdsp::fx::ResampleIIR<qwqdsp::fx::coeff::MedianCoeffs<float>, 127> resampler;
-        resampler.Init(infile.getSampleRate(), 16000);
-        input_data = resampler.Process<float>(infile.samples.front());
+    if (!qwqdsp::pitch::LoadAudio16k(kAudioPath, input_data)) {
+        return 1;
     }
-    else {
-        input_data = infile.samples.front();
+
+    // 音频的stft只算一次, 模型跳过自己的STFT, 显示用同一份频谱
+    // int8模型的窗和float模型一样, 从float模型读取
+    using FrontEnd = qwqdsp::pitch::SwiftF0FrontEnd;
+    FrontEnd front_end;
+    if (!front_end.Init(kModelPath)) {
+        return 1;
     }
 
     // Swift_F0 detect pitch
-    Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "SwiftF0");
-    Ort::SessionOptions session_options;
- 
-    Ort::Session session(env, kModelPath, session_options);
- 
-    auto input_name = session.GetInputNames().front();
-    auto output_name = session.GetOutputNames();
- 
-    int64_t batch_size = 1;  
-    std::vector<int64_t> input_shape = {batch_size, static_cast<int64_t>(input_data.size())}; 
-
-    Ort::MemoryInfo memory_info = Ort::MemoryInfo::CreateCpu(
-        OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
-    Ort::Value input_tensor = Ort::Value::CreateTensor<float>(
-        memory_info, input_data.data(), input_data.size(),
-        input_shape.data(), input_shape.size());
-
-    const char* input_names[] = {input_name.c_str()};
-    const char* output_names[] = {output_name[0].c_str(), output_name[1].c_str()};
-
-    auto output_tensors = session.Run(
-        Ort::RunOptions{},
-        input_names, &input_tensor, 1,
-        output_names, 2
-    );
+#ifdef SWIFT_F0_NATIVE
+    qwqdsp::pitch::ChunkedPitchDetector<qwqdsp::pitch::NativePitchDetector> detector;
+    detector.Init(kChunkFrames, batch_size);
+    if (!detector.GetDetector().Init(kModelPath)) {
+        return 1;
+    }
+#else
+    qwqdsp::pitch::ChunkedPitchDetector<qwqdsp::pitch::PitchDetector> detector;
+    detector.Init(kChunkFrames, batch_size);
+    detector.GetDetector().Init(model_path, detector.GetWindowFrames(), batch_size, session_config,
+                                qwqdsp::pitch::PitchDetector::InputType::kLogMagnitude);
+#endif
+
+    // front end一次算kFrontEndFrames帧, 送进分块推理, 频谱直接画进图像, 不保存整段的log|STFT|和频谱
+    constexpr size_t kNumBins = FrontEnd::kFFTSize / 2 + 1;
+    const size_t num_frames = FrontEnd::NumFrames(input_data.size());
+    auto img = GenImageColor(num_frames, kNumBins, BLACK);
+    float min_db_gain = std::pow(10.0f, kSpectrumFloorDb / 20.0f);
+    float window_sum = 0;
+    for (float w : front_end.GetWindow()) {
+        window_sum += w;
+    }
+    const float scale = 2.0f / window_sum;
+    std::vector<float> log_magnitude(kFrontEndFrames * FrontEnd::kNumFreqs);
+    detector.BeginLogMagnitude(num_frames);
+    for (size_t first = 0; first < num_frames; first += kFrontEndFrames) {
+        const size_t count = std::min(kFrontEndFrames, num_frames - first);
+        std::span<float> block{log_magnitude.data(), count * FrontEnd::kNumFreqs};
+        front_end.Process(input_data, first, block, [&](size_t frame, std::span<const float> reim) {
+            for (size_t j = 0; j < kNumBins; ++j) {
+                float re = reim[2 * j];
+                float im = reim[2 * j + 1];
+                float g = std::sqrt(re * re + im * im) * scale;
+                float db = kSpectrumFloorDb;
+                if (g > min_db_gain) {
+                    db = 20.0f * std::log10(g);
+                }
+                float gain_normal = (db - kSpectrumFloorDb) / (kSpectrumTopDb - kSpectrumFloorDb);
+                auto color = GetSpectrumColor(gain_normal);
+                ImageDrawPixel(&img, frame, kNumBins - 1 - j, color);
+            }
+        });
+        detector.PushLogMagnitude(block);
+    }
 
     // get output
-    auto* pitch_ptr = output_tensors[0].GetTensorMutableData<float>();
-    auto shape_info = output_tensors[0].GetTensorTypeAndShapeInfo();
-    auto shape = shape_info.GetShape();
-    auto num_frames = shape[1];
-    auto* confidence_ptr = output_tensors[1].GetTensorMutableData<float>();
+    const float* pitch_ptr = detector.GetPitch().data();
+    const float* confidence_ptr = detector.GetConfidence().data();
 
-    // draw audio as spectrum and pitch
+    // draw pitch
     InitWindow(kWindowWidth, kWindowHeight, "swift_f0_cpp");
-    qwqdsp::segement::Slice1D<float> slice{input_data};
-    qwqdsp::spectral::OourasRealFFT fft;
-
-    // this matchs model's stft parameter
-    constexpr size_t kFFTSize = 1024;
-    constexpr size_t kNumBins = kFFTSize / 2 + 1;
-    constexpr size_t kHopSize = 256;
-
-    fft.Init(kFFTSize);
-    auto img = GenImageColor(num_frames, kNumBins, BLACK);
-    float min_db_gain = std::pow(10.0f, kSpectrumFloorDb / 20.0f);
-    float fs = static_cast<float>(infile.getSampleRate());
+    float fs = 16000.0f;
     for (size_t i = 0; i < num_frames; ++i) {
-        float x[kFFTSize];
-        slice.Read(kFFTSize, kHopSize, x);
-        float reim[kFFTSize+2];
-        fft.FFT(x, reim);
-        
-        // draw spectrum
-        float scale = 2.0f / fft.GetFFTSize();
-        for (size_t j = 0; j < kNumBins; ++j) {
-            float re = reim[2 * j];
-            float im = reim[2 * j + 1];
-            float g = std::sqrt(re * re + im * im) * scale;
-            float db = kSpectrumFloorDb;
-            if (g > min_db_gain) {
-                db = 20.0f * std::log10(g);
-            }
-            float gain_normal = (db - kSpectrumFloorDb) / (kSpectrumTopDb - kSpectrumFloorDb);
-            auto color = GetSpectrumColor(gain_normal);
-            ImageDrawPixel(&img, i, kNumBins - 1 - j, color);
-        }
-
-        // draw pitch
         if (confidence_ptr[i] > kConfidence) {
             float pitch = pitch_ptr[i];
             float freq_normal = pitch / (fs / 2.0f);
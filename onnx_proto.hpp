@@ -0,0 +1,334 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace qwqdsp::pitch::onnx {
+/**
+ * @brief 读取/改写model.onnx需要的那一点protobuf
+ */
+struct ProtoReader {
+    explicit ProtoReader(std::string_view b) noexcept : buffer(b) {}
+
+    std::string_view buffer;
+    size_t pos{};
+    // 当前字段
+    size_t field_begin{};
+    uint32_t field{};
+    uint32_t wire_type{};
+    uint64_t value{};
+    std::string_view bytes;
+
+    bool Varint(uint64_t& out) noexcept {
+        out = 0;
+        for (int shift = 0; pos < buffer.size() && shift < 64; shift += 7) {
+            auto c = static_cast<uint8_t>(buffer[pos++]);
+            out |= static_cast<uint64_t>(c & 0x7f) << shift;
+            if (c < 0x80) return true;
+        }
+        return false;
+    }
+
+    bool Next() noexcept {
+        if (pos >= buffer.size()) return false;
+        field_begin = pos;
+        uint64_t key;
+        if (!Varint(key)) return false;
+        field = static_cast<uint32_t>(key >> 3);
+        wire_type = static_cast<uint32_t>(key & 7);
+        switch (wire_type) {
+        case 0:
+            return Varint(value);
+        case 1:
+            if (pos + 8 > buffer.size()) return false;
+            bytes = buffer.substr(pos, 8);
+            pos += 8;
+            return true;
+        case 2:
+            if (!Varint(value) || value > buffer.size() - pos) return false;
+            bytes = buffer.substr(pos, value);
+            pos += value;
+            return true;
+        case 5:
+            if (pos + 4 > buffer.size()) return false;
+            bytes = buffer.substr(pos, 4);
+            pos += 4;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * @brief 当前字段编码后的原始字节
+     */
+    std::string_view Raw() const noexcept {
+        return buffer.substr(field_begin, pos - field_begin);
+    }
+};
+
+inline void AppendVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+inline void AppendBytes(std::string& out, uint32_t field, std::string_view bytes) {
+    AppendVarint(out, (static_cast<uint64_t>(field) << 3) | 2);
+    AppendVarint(out, bytes.size());
+    out.append(bytes);
+}
+
+inline void AppendVarintField(std::string& out, uint32_t field, uint64_t v) {
+    AppendVarint(out, static_cast<uint64_t>(field) << 3);
+    AppendVarint(out, v);
+}
+
+/**
+ * @brief 把message里所有编号为field的子message替换成func(bytes)
+ * @tparam Func std::string(std::string_view)
+ */
+template<class Func>
+std::string RewriteField(std::string_view message, uint32_t field, Func&& func) {
+    std::string out;
+    out.reserve(message.size());
+    ProtoReader r{message};
+    while (r.Next()) {
+        if (r.field == field && r.wire_type == 2) {
+            AppendBytes(out, field, func(r.bytes));
+        }
+        else {
+            out.append(r.Raw());
+        }
+    }
+    return out;
+}
+
+inline std::string RemoveField(std::string_view message, uint32_t field) {
+    std::string out;
+    out.reserve(message.size());
+    ProtoReader r{message};
+    while (r.Next()) {
+        if (r.field != field) {
+            out.append(r.Raw());
+        }
+    }
+    return out;
+}
+
+inline bool ReadFile(const std::filesystem::path& path, std::string& out) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file) return false;
+    out.assign(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
+    return true;
+}
+
+/**
+ * @brief 导出的model.onnx输入是{1, audio_length}, 把第0维改成动态的batch
+ *        graph本身(Pad/STFT/Conv/Reshape(-1, 200))支持任意batch
+ *        中间结果的value_info也写死了batch=1, 它们只是形状提示, 直接去掉
+ */
+inline std::string MakeBatchDynamic(std::string_view model) {
+    // ModelProto.graph = 7, GraphProto.input = 11, GraphProto.value_info = 13
+    // ValueInfoProto.type = 2, TypeProto.tensor_type = 1, TypeProto.Tensor.shape = 2
+    // TensorShapeProto.dim = 1, Dimension.dim_param = 2
+    auto shape = [](std::string_view message) {
+        std::string out;
+        bool first = true;
+        ProtoReader r{message};
+        while (r.Next()) {
+            if (r.field == 1 && first) {
+                first = false;
+                std::string dim;
+                AppendBytes(dim, 2, "batch");
+                AppendBytes(out, 1, dim);
+            }
+            else {
+                out.append(r.Raw());
+            }
+        }
+        return out;
+    };
+    auto tensor_type = [&](std::string_view message) { return RewriteField(message, 2, shape); };
+    auto type = [&](std::string_view message) { return RewriteField(message, 1, tensor_type); };
+    auto value_info = [&](std::string_view message) { return RewriteField(message, 2, type); };
+    auto graph = [&](std::string_view message) {
+        return RemoveField(RewriteField(message, 11, value_info), 13);
+    };
+    return RewriteField(model, 7, graph);
+}
+
+/**
+ * @brief 把音频输入换成log|STFT|, 模型里的Pad -> STFT -> |X| -> Slice -> Log不再运行
+ *        新的输入是log_magnitude{batch, time_frames, num_freqs}, 时间在前方便逐帧追加
+ *        后面接一个Transpose, 输出原来Log节点的输出{batch, num_freqs, time_frames}
+ *        只被Log用到的节点和initializer都删掉, value_info也去掉, batch是动态的
+ * @return 模型里没有Log节点时返回空
+ */
+inline std::string MakeLogMagnitudeInput(std::string_view model, size_t num_freqs) {
+    // NodeProto: input = 1, output = 2, name = 3, op_type = 4, attribute = 5
+    // AttributeProto: name = 1, ints = 8, type = 20(INTS = 7)
+    // GraphProto: node = 1, initializer = 5, input = 11, output = 12, value_info = 13
+    // TensorProto.name = 8, ValueInfoProto.name = 1
+    constexpr std::string_view kInputName = "log_magnitude";
+    struct Node {
+        std::string_view bytes;
+        std::string_view op_type;
+        std::vector<std::string_view> inputs;
+        std::vector<std::string_view> outputs;
+    };
+    auto name_of = [](std::string_view message, uint32_t field) {
+        ProtoReader r{message};
+        while (r.Next()) {
+            if (r.field == field && r.wire_type == 2) return r.bytes;
+        }
+        return std::string_view{};
+    };
+
+    bool found = false;
+    auto graph = [&](std::string_view message) {
+        std::vector<Node> nodes;
+        std::unordered_set<std::string_view> needed;
+        ProtoReader r{message};
+        while (r.Next()) {
+            if (r.field == 1) {
+                Node& node = nodes.emplace_back();
+                node.bytes = r.bytes;
+                ProtoReader n{r.bytes};
+                while (n.Next()) {
+                    if (n.field == 1) node.inputs.push_back(n.bytes);
+                    else if (n.field == 2) node.outputs.push_back(n.bytes);
+                    else if (n.field == 4) node.op_type = n.bytes;
+                }
+            }
+            else if (r.field == 12) {
+                needed.insert(name_of(r.bytes, 1));
+            }
+        }
+        std::string_view log_output;
+        for (const auto& node : nodes) {
+            if (node.op_type == "Log" && !node.outputs.empty()) log_output = node.outputs.front();
+        }
+        if (log_output.empty()) return std::string{message};
+        found = true;
+
+        // node按拓扑顺序排列, 从后往前找出输出用得到的node, Log的输出改由Transpose提供
+        std::vector<bool> keep(nodes.size());
+        for (size_t i = nodes.size(); i-- > 0;) {
+            for (auto output : nodes[i].outputs) {
+                if (output != log_output && needed.contains(output)) keep[i] = true;
+            }
+            if (keep[i]) {
+                for (auto input : nodes[i].inputs) needed.insert(input);
+            }
+        }
+
+        std::string transpose;
+        AppendBytes(transpose, 1, kInputName);
+        AppendBytes(transpose, 2, log_output);
+        AppendBytes(transpose, 3, "/LogMagnitudeTranspose");
+        AppendBytes(transpose, 4, "Transpose");
+        std::string perm;
+        AppendBytes(perm, 1, "perm");
+        AppendVarintField(perm, 8, 0);
+        AppendVarintField(perm, 8, 2);
+        AppendVarintField(perm, 8, 1);
+        AppendVarintField(perm, 20, 7);
+        AppendBytes(transpose, 5, perm);
+
+        auto dim_param = [](std::string_view name) {
+            std::string dim;
+            AppendBytes(dim, 2, name);
+            return dim;
+        };
+        std::string freq_dim;
+        AppendVarintField(freq_dim, 1, num_freqs);
+        std::string shape;
+        AppendBytes(shape, 1, dim_param("batch"));
+        AppendBytes(shape, 1, dim_param("time_frames"));
+        AppendBytes(shape, 1, freq_dim);
+        std::string tensor_type;
+        AppendVarintField(tensor_type, 1, 1);
+        AppendBytes(tensor_type, 2, shape);
+        std::string type;
+        AppendBytes(type, 1, tensor_type);
+        std::string input;
+        AppendBytes(input, 1, kInputName);
+        AppendBytes(input, 2, type);
+
+        std::string out;
+        out.reserve(message.size());
+        AppendBytes(out, 1, transpose);
+        size_t node_idx = 0;
+        r = ProtoReader{message};
+        while (r.Next()) {
+            switch (r.field) {
+            case 1:
+                if (keep[node_idx++]) out.append(r.Raw());
+                break;
+            case 5:
+                if (needed.contains(name_of(r.bytes, 8))) out.append(r.Raw());
+                break;
+            case 11:
+                AppendBytes(out, 11, input);
+                break;
+            case 13:
+                break;
+            default:
+                out.append(r.Raw());
+                break;
+            }
+        }
+        return out;
+    };
+    std::string out = RewriteField(model, 7, graph);
+    return found ? out : std::string{};
+}
+
+/**
+ * @brief 把Softmax节点的输出{batch, time_frames, num_pitch_bins}也作为graph的输出, 名字不变
+ * @param name 输出Softmax的名字
+ * @return 模型里没有Softmax节点时返回空
+ */
+inline std::string AddSoftmaxOutput(std::string_view model, std::string& name) {
+    name.clear();
+    auto graph = [&](std::string_view message) {
+        ProtoReader r{message};
+        while (r.Next()) {
+            if (r.field != 1) continue;
+            std::string_view op_type;
+            std::string_view output;
+            ProtoReader n{r.bytes};
+            while (n.Next()) {
+                if (n.field == 2 && output.empty()) output = n.bytes;
+                else if (n.field == 4) op_type = n.bytes;
+            }
+            if (op_type == "Softmax") name = output;
+        }
+        if (name.empty()) return std::string{message};
+
+        // 只写元素类型, 形状留给onnxruntime推断
+        std::string tensor_type;
+        AppendVarintField(tensor_type, 1, 1);
+        std::string type;
+        AppendBytes(type, 1, tensor_type);
+        std::string value_info;
+        AppendBytes(value_info, 1, name);
+        AppendBytes(value_info, 2, type);
+
+        std::string out{message};
+        AppendBytes(out, 12, value_info);
+        return out;
+    };
+    std::string out = RewriteField(model, 7, graph);
+    return name.empty() ? std::string{} : out;
+}
+}
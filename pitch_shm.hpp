@@ -0,0 +1,334 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 一帧音高, realtime输出给其他程序的格式
+ */
+struct PitchFrame {
+    // Viterbi的第几帧, 每个hop一帧
+    int64_t frame;
+    // 这一帧窗口的中心是采集开始以后的第几个采样
+    int64_t sample;
+    // 0: 无声
+    float pitch;
+    float confidence;
+    // 第几路声音, realtime所有设备的声道按顺序编号
+    int32_t channel;
+};
+
+/**
+ * @brief 共享内存里的音高环形缓冲
+ *        [PitchShmHeader][PitchShmSlot * capacity], 写的一方每帧写一个slot, 不等读的一方
+ *        多个声道写在同一个环里, 用PitchShmSlot::channel区分
+ *        每个slot有自己的sequence, 写的时候是奇数, 写完是2 * (frame序号 + 1), 读的一方用它判断读到的是不是完整的那一帧
+ *        写的一方重新Open()时不在原地重置, 而是把旧的标记为replaced再shm_unlink, 创建新的, 已经映射旧的读者不受影响
+ */
+struct PitchShmHeader {
+    static constexpr uint32_t kMagic = 0x50304653; // "SF0P"
+    static constexpr uint32_t kVersion = 3;
+
+    uint32_t magic;
+    uint32_t version;
+    // slot的个数, 2的幂
+    uint32_t capacity;
+    uint32_t slot_size;
+    float sample_rate;
+    // 1: 写的一方已经换成了同名的新的共享内存, 这块不会再写
+    std::atomic<uint32_t> replaced;
+    // 一共写了多少帧, 第n帧在slot[n & (capacity - 1)]
+    alignas(64) std::atomic<uint64_t> write_count;
+};
+
+struct PitchShmSlot {
+    std::atomic<uint64_t> sequence;
+    // 数据也是atomic, relaxed读写, 读的一方和写的一方同时访问不是数据竞争
+    std::atomic<int64_t> frame;
+    std::atomic<int64_t> sample;
+    std::atomic<float> pitch;
+    std::atomic<float> confidence;
+    std::atomic<int32_t> channel;
+};
+
+// 要在进程之间共享, 不能是用锁实现的atomic
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<int64_t>::is_always_lock_free
+              && std::atomic<float>::is_always_lock_free
+              && std::atomic<int32_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+
+#ifndef _WIN32
+/**
+ * @brief 创建shm_open(name)并写入帧, 只能有一个写的一方
+ */
+class PitchShmWriter {
+public:
+    PitchShmWriter() = default;
+    PitchShmWriter(const PitchShmWriter&) = delete;
+    PitchShmWriter& operator=(const PitchShmWriter&) = delete;
+    ~PitchShmWriter() {
+        Close();
+    }
+
+    /**
+     * @brief 已经有同名的共享内存(比如上一次运行留下的)时, 把它标记为replaced并shm_unlink, 再创建新的
+     *        原地ftruncate和清零的话, 映射着它的读者会停在旧的位置读不到新帧, 变小时还会SIGBUS
+     * @param name shm_open的名字, "/pitch"
+     * @param min_capacity 向上取到2的幂
+     */
+    bool Open(const std::string& name, size_t min_capacity, float sample_rate) {
+        Close();
+        const size_t capacity = std::bit_ceil(std::max<size_t>(min_capacity, 1));
+        size_ = sizeof(PitchShmHeader) + capacity * sizeof(PitchShmSlot);
+        MarkReplaced(name);
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+
+        header_ = static_cast<PitchShmHeader*>(p);
+        slots_ = reinterpret_cast<PitchShmSlot*>(header_ + 1);
+        mask_ = capacity - 1;
+
+        // 新建的共享内存都是0, 填好header以后再写magic, 读者才认
+        header_->version = PitchShmHeader::kVersion;
+        header_->capacity = static_cast<uint32_t>(capacity);
+        header_->slot_size = sizeof(PitchShmSlot);
+        header_->sample_rate = sample_rate;
+        std::atomic_ref<uint32_t>{header_->magic}.store(PitchShmHeader::kMagic, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 不删除共享内存, 读的一方还可以读到最后写的帧
+     */
+    void Close() noexcept {
+        if (header_ != nullptr) {
+            munmap(header_, size_);
+            header_ = nullptr;
+            slots_ = nullptr;
+        }
+    }
+
+    bool IsOpen() const noexcept {
+        return header_ != nullptr;
+    }
+
+    void Write(const PitchFrame& frame) noexcept {
+        const uint64_t n = header_->write_count.load(std::memory_order_relaxed);
+        PitchShmSlot& slot = slots_[n & mask_];
+        slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.frame.store(frame.frame, std::memory_order_relaxed);
+        slot.sample.store(frame.sample, std::memory_order_relaxed);
+        slot.pitch.store(frame.pitch, std::memory_order_relaxed);
+        slot.confidence.store(frame.confidence, std::memory_order_relaxed);
+        slot.channel.store(frame.channel, std::memory_order_relaxed);
+        slot.sequence.store(2 * n + 2, std::memory_order_release);
+        header_->write_count.store(n + 1, std::memory_order_release);
+    }
+private:
+    /**
+     * @brief 告诉还映射着旧的共享内存的读者重新Open(), 旧的不是PitchShmHeader时什么也不做
+     */
+    static void MarkReplaced(const std::string& name) noexcept {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) return;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(PitchShmHeader)) {
+            ::close(fd);
+            return;
+        }
+        void* p = mmap(nullptr, sizeof(PitchShmHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return;
+        auto* header = static_cast<PitchShmHeader*>(p);
+        if (std::atomic_ref<uint32_t>{header->magic}.load(std::memory_order_acquire) == PitchShmHeader::kMagic
+            && header->version == PitchShmHeader::kVersion) {
+            header->replaced.store(1, std::memory_order_release);
+        }
+        munmap(p, sizeof(PitchShmHeader));
+    }
+
+    PitchShmHeader* header_{};
+    PitchShmSlot* slots_{};
+    size_t size_{};
+    size_t mask_{};
+};
+
+/**
+ * @brief 只读地映射PitchShmWriter写的共享内存, 不加锁也不调用系统函数, 可以有任意多个读的一方(线程或者进程)
+ *        每个slot按seqlock读: 读数据前后sequence都是2 * (n + 1)才是完整的第n帧
+ *        读得比写得慢超过capacity帧时, 被覆盖的帧跳过并计数
+ *        写的一方重启后IsReplaced(), 这时再Poll()到0把旧的读完, 然后重新Open()
+ */
+class PitchShmReader {
+public:
+    enum class ReadResult {
+        kOk,
+        // 第n帧还没写
+        kNotWritten,
+        // 第n帧已经被覆盖了, 或者读的时候正在被覆盖
+        kOverwritten
+    };
+
+    PitchShmReader() = default;
+    PitchShmReader(const PitchShmReader&) = delete;
+    PitchShmReader& operator=(const PitchShmReader&) = delete;
+    ~PitchShmReader() {
+        Close();
+    }
+
+    /**
+     * @return false: 不存在, 写的一方还没写好header, 版本/大小对不上, 或者已经被替换了
+     */
+    bool Open(const std::string& name) {
+        Close();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(PitchShmHeader)) {
+            ::close(fd);
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+
+        header_ = static_cast<const PitchShmHeader*>(p);
+        const uint32_t magic = std::atomic_ref<uint32_t>{const_cast<uint32_t&>(header_->magic)}.load(std::memory_order_acquire);
+        const size_t capacity = header_->capacity;
+        if (magic != PitchShmHeader::kMagic || header_->version != PitchShmHeader::kVersion
+            || header_->slot_size != sizeof(PitchShmSlot) || !std::has_single_bit(capacity)
+            || size_ < sizeof(PitchShmHeader) + capacity * sizeof(PitchShmSlot) || IsReplaced()) {
+            Close();
+            return false;
+        }
+        slots_ = reinterpret_cast<const PitchShmSlot*>(header_ + 1);
+        mask_ = capacity - 1;
+        sample_rate_ = header_->sample_rate;
+        // 从还没被覆盖的最早一帧开始
+        const uint64_t written = GetWriteCount();
+        next_ = written > capacity ? written - capacity : 0;
+        num_lost_ = 0;
+        return true;
+    }
+
+    void Close() noexcept {
+        if (header_ != nullptr) {
+            munmap(const_cast<PitchShmHeader*>(header_), size_);
+            header_ = nullptr;
+            slots_ = nullptr;
+        }
+    }
+
+    bool IsOpen() const noexcept {
+        return header_ != nullptr;
+    }
+
+    size_t GetCapacity() const noexcept {
+        return mask_ + 1;
+    }
+
+    // PitchFrame::sample / GetSampleRate()是帧中心的时间, 秒
+    float GetSampleRate() const noexcept {
+        return sample_rate_;
+    }
+
+    uint64_t GetWriteCount() const noexcept {
+        return header_->write_count.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 写的一方重新Open()了同一个名字, 这块共享内存不会再有新的帧
+     *        之后的Poll()还能读完替换之前写的帧
+     */
+    bool IsReplaced() const noexcept {
+        return header_->replaced.load(std::memory_order_acquire) != 0;
+    }
+
+    /**
+     * @brief 读第n帧, 不影响Poll()的位置
+     */
+    ReadResult Read(uint64_t n, PitchFrame& frame) const noexcept {
+        const PitchShmSlot& slot = slots_[n & mask_];
+        const uint64_t expected = 2 * n + 2;
+        const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before != expected) {
+            return before < expected ? ReadResult::kNotWritten : ReadResult::kOverwritten;
+        }
+        frame.frame = slot.frame.load(std::memory_order_relaxed);
+        frame.sample = slot.sample.load(std::memory_order_relaxed);
+        frame.pitch = slot.pitch.load(std::memory_order_relaxed);
+        frame.confidence = slot.confidence.load(std::memory_order_relaxed);
+        frame.channel = slot.channel.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != expected) {
+            return ReadResult::kOverwritten;
+        }
+        return ReadResult::kOk;
+    }
+
+    /**
+     * @brief 按顺序读上次之后写的帧, 最多out.size()个
+     * @return 读到的帧数, 0: 没有新的帧
+     */
+    size_t Poll(std::span<PitchFrame> out) noexcept {
+        const uint64_t written = GetWriteCount();
+        if (written - next_ > GetCapacity()) {
+            num_lost_ += written - GetCapacity() - next_;
+            next_ = written - GetCapacity();
+        }
+        size_t num = 0;
+        while (num < out.size() && next_ < written) {
+            switch (Read(next_, out[num])) {
+            case ReadResult::kOk:
+                ++num;
+                ++next_;
+                break;
+            case ReadResult::kOverwritten:
+                ++num_lost_;
+                ++next_;
+                break;
+            case ReadResult::kNotWritten:
+                return num;
+            }
+        }
+        return num;
+    }
+
+    /**
+     * @brief Poll()因为读得太慢跳过的帧数
+     */
+    uint64_t GetNumLost() const noexcept {
+        return num_lost_;
+    }
+private:
+    const PitchShmHeader* header_{};
+    const PitchShmSlot* slots_{};
+    size_t size_{};
+    size_t mask_{};
+    float sample_rate_{};
+    // Poll()下一个要读的帧
+    uint64_t next_{};
+    uint64_t num_lost_{};
+};
+#endif
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "pitch_shm.hpp"
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace qwqdsp::pitch {
+/**
+ * @brief realtime --headless的输出, 从命令行的"--sink=..."打开
+ *        stdout       每个声道每帧一行frame,sample,time,pitch,confidence,channel
+ *        unix:PATH    在PATH上监听的UNIX domain socket, 每个连上来的客户端收到和stdout一样的行
+ *                     写不进去的客户端直接断开, 不让一个慢的客户端拖住分析
+ *        shm:NAME     PitchShmWriter, 共享内存的环形缓冲
+ *        Write()只在一个线程里调用
+ */
+class PitchSink {
+public:
+    static constexpr const char* kUsage = "  --sink=stdout|unix:PATH|shm:NAME\n";
+    // shm:NAME的slot个数, 16kHz下约16s
+    static constexpr size_t kShmCapacity = 1024;
+
+    PitchSink() = default;
+    PitchSink(const PitchSink&) = delete;
+    PitchSink& operator=(const PitchSink&) = delete;
+    ~PitchSink() {
+        Close();
+    }
+
+    /**
+     * @param spec "--sink="后面的部分
+     * @return false: 格式不对, 打不开, 或者这个平台不支持
+     */
+    bool Open(std::string_view spec, float sample_rate) {
+        Close();
+        sample_rate_ = sample_rate;
+        if (spec == "stdout") {
+            kind_ = Kind::kStdout;
+            return true;
+        }
+#ifndef _WIN32
+        if (spec.starts_with("unix:")) {
+            kind_ = Kind::kUnix;
+            return Listen(std::string{spec.substr(5)});
+        }
+        if (spec.starts_with("shm:")) {
+            kind_ = Kind::kShm;
+            return shm_.Open(std::string{spec.substr(4)}, kShmCapacity, sample_rate);
+        }
+#endif
+        return false;
+    }
+
+    void Close() noexcept {
+#ifndef _WIN32
+        for (int fd : clients_) {
+            ::close(fd);
+        }
+        clients_.clear();
+        if (listen_fd_ >= 0) {
+            ::close(listen_fd_);
+            ::unlink(socket_path_.c_str());
+            listen_fd_ = -1;
+        }
+        shm_.Close();
+#endif
+        kind_ = Kind::kNone;
+    }
+
+    void Write(const PitchFrame& frame) {
+        switch (kind_) {
+        case Kind::kNone:
+            break;
+        case Kind::kStdout: {
+            char line[128];
+            int len = Format(line, sizeof(line), frame);
+            std::fwrite(line, 1, len, stdout);
+            std::fflush(stdout);
+            break;
+        }
+#ifndef _WIN32
+        case Kind::kUnix: {
+            Accept();
+            char line[128];
+            size_t len = static_cast<size_t>(Format(line, sizeof(line), frame));
+            for (size_t i = 0; i < clients_.size();) {
+                if (::send(clients_[i], line, len, MSG_DONTWAIT | MSG_NOSIGNAL) == static_cast<ssize_t>(len)) {
+                    ++i;
+                    continue;
+                }
+                // 断开了, 或者缓冲满了写不完整
+                ::close(clients_[i]);
+                clients_.erase(clients_.begin() + i);
+            }
+            break;
+        }
+        case Kind::kShm:
+            shm_.Write(frame);
+            break;
+#endif
+        }
+    }
+private:
+    enum class Kind {
+        kNone,
+        kStdout,
+        kUnix,
+        kShm
+    };
+
+    int Format(char* line, size_t size, const PitchFrame& frame) const noexcept {
+        return std::snprintf(line, size, "%lld,%lld,%.6f,%.3f,%.4f,%d\n",
+            static_cast<long long>(frame.frame), static_cast<long long>(frame.sample),
+            frame.sample / static_cast<double>(sample_rate_), frame.pitch, frame.confidence,
+            static_cast<int>(frame.channel));
+    }
+
+#ifndef _WIN32
+    bool Listen(const std::string& path) {
+        sockaddr_un addr{};
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+        addr.sun_family = AF_UNIX;
+        path.copy(addr.sun_path, path.size());
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        ::unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            || ::listen(fd, 8) != 0
+            || ::fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+            ::close(fd);
+            return false;
+        }
+        listen_fd_ = fd;
+        socket_path_ = path;
+        return true;
+    }
+
+    void Accept() {
+        for (;;) {
+            int fd = ::accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) return;
+            clients_.push_back(fd);
+        }
+    }
+
+    int listen_fd_{-1};
+    std::string socket_path_;
+    std::vector<int> clients_;
+    PitchShmWriter shm_;
+#endif
+    Kind kind_{Kind::kNone};
+    float sample_rate_{16000.0f};
+};
+}
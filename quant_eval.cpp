@@ -0,0 +1,134 @@
+// 对比INT8模型和float模型在一组音频上的精度和速度, float模型的输出作为参考
+// usage: swift_f0_quant_eval [options] <model.onnx> <model_int8.onnx> <a.wav> [b.wav ...]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+#include "swift_f0.hpp"
+#include "swift_f0_audio.hpp"
+#include "swift_f0_session_config.hpp"
+
+// 和main.cpp的kConfidence一样, 超过它算有声
+constexpr float kVoicedConfidence = 0.9f;
+// raw pitch accuracy: 参考有声的帧里, 音高误差在50音分以内的比例(不管INT8判断的有声无声)
+constexpr float kPitchToleranceCents = 50.0f;
+constexpr float kMinRawPitchAccuracy = 0.99f;
+constexpr float kMinVoicingF1 = 0.98f;
+
+/**
+ * @return 第二次Process()的秒数, 第一次包含了分配内存
+ */
+static double TimedProcess(qwqdsp::pitch::PitchDetector& detector, std::span<const float> x) {
+    detector.Process(x);
+    auto begin = std::chrono::steady_clock::now();
+    detector.Process(x);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+struct Stats {
+    size_t num_frames{};
+    size_t true_positive{};
+    size_t false_positive{};
+    size_t false_negative{};
+    size_t pitch_correct{};
+    double float_seconds{};
+    double int8_seconds{};
+
+    float RawPitchAccuracy() const noexcept {
+        size_t reference_voiced = true_positive + false_negative;
+        return reference_voiced == 0 ? 1.0f : static_cast<float>(pitch_correct) / reference_voiced;
+    }
+
+    float VoicingF1() const noexcept {
+        size_t denominator = 2 * true_positive + false_positive + false_negative;
+        return denominator == 0 ? 1.0f : 2.0f * true_positive / denominator;
+    }
+
+    void Print(const char* name) const {
+        std::printf("%s: frames=%zu raw_pitch_accuracy=%.4f voicing_f1=%.4f (tp=%zu fp=%zu fn=%zu) float=%.0f frames/s int8=%.0f frames/s speedup=%.2fx\n",
+            name, num_frames, RawPitchAccuracy(), VoicingF1(), true_positive, false_positive, false_negative,
+            num_frames / float_seconds, num_frames / int8_seconds, float_seconds / int8_seconds);
+    }
+};
+
+int main(int argc, char const *argv[]) {
+    std::vector<const char*> args;
+    qwqdsp::pitch::SessionConfig session_config;
+    bool bad_option = false;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-' || argv[i][1] != '-') {
+            args.push_back(argv[i]);
+        }
+        else if (!session_config.ParseArgument(argv[i])) {
+            std::printf("bad option %s\n", argv[i]);
+            bad_option = true;
+        }
+    }
+    if (args.size() < 3 || bad_option) {
+        std::printf("usage: %s [options] <model.onnx> <model_int8.onnx> <a.wav> [b.wav ...]\n%s",
+            argv[0], qwqdsp::pitch::SessionConfig::kUsage);
+        return 1;
+    }
+    std::filesystem::path float_path{args[0]};
+    std::filesystem::path int8_path{args[1]};
+
+    qwqdsp::pitch::PitchDetector float_detector;
+    qwqdsp::pitch::PitchDetector int8_detector;
+    float_detector.Init(float_path.c_str(), 16000, 1, session_config);
+    int8_detector.Init(int8_path.c_str(), 16000, 1, session_config);
+
+    Stats total;
+    bool all_loaded = true;
+    for (size_t i = 2; i < args.size(); ++i) {
+        std::vector<float> input_data;
+        if (!qwqdsp::pitch::LoadAudio16k(args[i], input_data)) {
+            std::printf("%s: can not load\n", args[i]);
+            all_loaded = false;
+            continue;
+        }
+
+        Stats stats;
+        stats.float_seconds = TimedProcess(float_detector, input_data);
+        stats.int8_seconds = TimedProcess(int8_detector, input_data);
+        stats.num_frames = float_detector.GetNumFrames();
+        for (size_t j = 0; j < stats.num_frames; ++j) {
+            bool reference_voiced = float_detector.GetConfidence()[j] > kVoicedConfidence;
+            bool voiced = int8_detector.GetConfidence()[j] > kVoicedConfidence;
+            if (reference_voiced) {
+                float cents = 1200.0f * std::log2(int8_detector.GetPitch()[j] / float_detector.GetPitch()[j]);
+                if (std::abs(cents) <= kPitchToleranceCents) {
+                    ++stats.pitch_correct;
+                }
+            }
+            if (reference_voiced && voiced) {
+                ++stats.true_positive;
+            }
+            else if (voiced) {
+                ++stats.false_positive;
+            }
+            else if (reference_voiced) {
+                ++stats.false_negative;
+            }
+        }
+        stats.Print(args[i]);
+
+        total.num_frames += stats.num_frames;
+        total.true_positive += stats.true_positive;
+        total.false_positive += stats.false_positive;
+        total.false_negative += stats.false_negative;
+        total.pitch_correct += stats.pitch_correct;
+        total.float_seconds += stats.float_seconds;
+        total.int8_seconds += stats.int8_seconds;
+    }
+    if (total.num_frames == 0) {
+        return 1;
+    }
+    total.Print("total");
+
+    bool passed = all_loaded
+        && total.RawPitchAccuracy() >= kMinRawPitchAccuracy
+        && total.VoicingF1() >= kMinVoicingF1;
+    std::printf("%s\n", passed ? "ok" : "FAILED");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+# 生成INT8版本的模型: python quantize.py model.onnx model_int8.onnx [calibration.wav ...]
+# 需要 pip install onnxruntime onnx numpy
+# 只量化conv_layers里中间两层(16->32, 32->64), 它们占了大部分时间, onnxruntime的QLinearConv在它们上面最快
+# 第一层(1->8)和最后一层(64->1)通道太少, 量化之后反而更慢, 保持float
+# 没有给校准音频时, 用固定种子生成的谐波/噪声/静音片段校准, 结果可以复现
+import sys
+import wave
+
+import numpy as np
+import onnx
+from onnxruntime.quantization import CalibrationDataReader, QuantFormat, QuantType, quantize_static
+
+SAMPLE_RATE = 16000
+QUANTIZED_LAYERS = (2, 3)
+
+
+def load_wav(path):
+    with wave.open(path) as w:
+        assert w.getsampwidth() == 2, "only 16bit wav"
+        assert w.getframerate() == SAMPLE_RATE, "resample to 16kHz first"
+        x = np.frombuffer(w.readframes(w.getnframes()), "<i2").astype(np.float32) / 32768
+        return x[:: w.getnchannels()]
+
+
+def synthetic_calibration():
+    rng = np.random.default_rng(0)
+    t = np.arange(SAMPLE_RATE * 2) / SAMPLE_RATE
+    for _ in range(16):
+        f0 = 50 * 2 ** rng.uniform(0, 4.5)
+        vibrato = 2 ** (rng.uniform(0, 0.1) * np.sin(2 * np.pi * rng.uniform(2, 7) * t))
+        phase = 2 * np.pi * np.cumsum(f0 * vibrato) / SAMPLE_RATE
+        num_harmonics = int(min(20, SAMPLE_RATE / 2 / (f0 * 1.2)))
+        x = sum(np.sin(k * phase) * rng.uniform(0.2, 1) / k for k in range(1, num_harmonics + 1))
+        x *= 10 ** (rng.uniform(-40, -3) / 20) / np.max(np.abs(x))
+        x += 10 ** (rng.uniform(-80, -40) / 20) * rng.standard_normal(len(t))
+        # 一段静音
+        x[rng.integers(0, len(t) // 2):][: SAMPLE_RATE // 4] = 0
+        yield x.astype(np.float32)
+
+
+class Reader(CalibrationDataReader):
+    def __init__(self, signals):
+        self.it = iter({"input_audio": x[None]} for x in signals)
+
+    def get_next(self):
+        return next(self.it, None)
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(f"usage: {sys.argv[0]} <model.onnx> <model_int8.onnx> [calibration.wav ...]")
+        return 1
+    model_path, output_path = sys.argv[1], sys.argv[2]
+    signals = [load_wav(p) for p in sys.argv[3:]] or list(synthetic_calibration())
+
+    model = onnx.load(model_path)
+    convs = [n.name for n in model.graph.node if n.op_type == "Conv" and n.name.startswith("/conv_layers/")]
+    quantize_static(
+        model_path,
+        output_path,
+        Reader(signals),
+        quant_format=QuantFormat.QOperator,
+        nodes_to_quantize=[convs[i] for i in QUANTIZED_LAYERS],
+        activation_type=QuantType.QUInt8,
+        weight_type=QuantType.QInt8,
+        per_channel=True,
+    )
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
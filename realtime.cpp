@@ -1,37 +1,185 @@
 #include <raylib.h>
-#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <memory>
+#include <thread>
 #include <vector>
-#include <semaphore>
-#include <onnxruntime_cxx_api.h>
 
 #include "miniaudio.h"
+#include "AudioFile.h"
+#include "hann.hpp"
+#include "pitch_sink.hpp"
 #include "reassignment.hpp"
-
-static std::array<float, 2048> audio_buffer{};
-static size_t wpos{};
-static std::binary_semaphore audio_lock{1};
-
-void MyAudioCallback(ma_device *pDevice, void *pOutput, const void *pInput, ma_uint32 frameCount) {
-    audio_lock.acquire();
-    const float* src = reinterpret_cast<const float*>(pInput);
-    while (frameCount--) {
-        audio_buffer[wpos++] = *src++;
-        wpos &= 2047;
-    }
-    audio_lock.release();
-}
+#include "resample_iir.hpp"
+#include "resample_coeffs.h"
+#include "spsc_ring.hpp"
+#include "swift_f0_frontend.hpp"
+#include "swift_f0_gate.hpp"
+#include "swift_f0_latency.hpp"
+#include "swift_f0_stream.hpp"
+#include "swift_f0_viterbi.hpp"
+#include "swift_f0_weights.hpp"
+#ifdef SWIFT_F0_NATIVE
+#include "swift_f0_native.hpp"
+#else
+#include "swift_f0.hpp"
+#include "swift_f0_session_config.hpp"
+#endif
+
+constexpr size_t kHopSize = qwqdsp::pitch::SwiftF0FrontEnd::kHopSize;
+// 模型的采样率, 采集用设备自己的采样率, 在音频回调里重采样到它
+constexpr float kSampleRate = 16000.0f;
+// 所有设备加起来最多同时跟踪的声道数
+constexpr size_t kMaxChannels = 8;
 
 constexpr float kConfidence = 0.9f;
+// true: 逐hop流式推理, 每帧只算新的一列, 结果和离线一致, 但有GetLatencySamples()的延迟
+// 流式推理每一列都要进卷积的历史, 不经过静音门限
+constexpr bool kStreamingPitch = false;
 constexpr int kWindowWidth = 1280;
 constexpr int kWindowHeight = 720;
-constexpr int kImageWidth = 192;
+// 一个hop一列, 6s
+constexpr int kImageWidth = 384;
 constexpr int kImageHeight = 512;
 constexpr size_t kFftSize = 1024;
-constexpr float kSampleRate = 16000.0f;
 constexpr size_t kNumBins = kFftSize / 2 + 1;
 constexpr float kSpectrumFloorDb = -60.0f;
 constexpr float kSpectrumTopDb = 10.0f;
 static float min_db_gain = std::pow(10.0f, kSpectrumFloorDb / 20.0f);
+// 推理最近kPitchFrames帧, 和以前输入kFftSize个采样输出的帧数一样
+constexpr size_t kPitchFrames = 4;
+constexpr size_t kLogMagnitudeSize = kPitchFrames * qwqdsp::pitch::SwiftF0FrontEnd::kNumFreqs;
+
+/**
+ * @brief 音频回调凑齐的一个hop, 带着它在采集流里的位置
+ */
+struct AudioHop {
+    // 第一个采样是采集开始以后的第几个kSampleRate的采样, 包括丢掉的hop
+    uint64_t first_sample;
+    // 凑齐这个hop的那次音频回调的时间, LatencyHistogram::NowNs()
+    int64_t capture_ns;
+    float samples[kHopSize];
+};
+// 0.5s, 分析线程卡住超过它才会丢数据, 整个hop一起丢
+constexpr size_t kAudioRingSize = 32;
+
+/**
+ * @brief 一路声音(一个设备或者--input的wav的一个声道), 有自己的采集和分析状态, 输出独立的音高
+ *        只有模型是所有声道共用的, 每个hop所有声道叠成一个batch推理一次
+ */
+struct Channel {
+    // 音频回调写, 分析线程按hop读, 两边都不加锁
+    qwqdsp::segement::SpscRing<AudioHop> audio_ring;
+    // 设备采样率 != kSampleRate时流式重采样, 滤波器的状态每个声道一份
+    qwqdsp::fx::ResampleIIR<qwqdsp::fx::coeff::MedianCoeffs<float>, 127> resampler;
+    // 重采样延迟取整, 时间戳减掉它, 对应声音到达设备的时间
+    int64_t resampler_latency_samples{};
+
+    // 下面只有音频回调访问
+    AudioHop capture_hop;
+    size_t capture_filled{};
+    uint64_t capture_samples{};
+
+    // 下面只有分析线程访问
+    // 从audio_ring取出来, 还没轮到分析的hop
+    AudioHop pending;
+    bool has_pending{};
+    // 最近kFftSize个采样, 每分析一个hop算一帧
+    // 第n个hop读进来以后窗口的中心是采样(n - 1) * kHopSize, 也就是离线推理的第n - 1帧
+    float analysis_frame[kFftSize]{};
+    float log_magnitude[kLogMagnitudeSize]{};
+    // log_magnitude每一帧的门限结果, 全部静音时不推理
+    bool column_silent[kPitchFrames]{true, true, true, true};
+    // 这个hop要不要模型的结果
+    bool needs_model{};
+    // 固定延迟的Viterbi代替每帧单独判断有声, 画出的音高比最新的hop晚GetLatencyFrames()帧
+    qwqdsp::pitch::StreamingViterbi viterbi;
+    // Viterbi最近输出的一帧, frame = -1: 还没有输出
+    qwqdsp::pitch::PitchFrame viterbi_output{-1, 0, 0.0f, 0.0f, 0};
+    qwqdsp::pitch::StreamingPitchDetector streaming_detector;
+
+    // 取出result_ring的线程访问, 已经写进sinks的最后一帧
+    int64_t last_written_frame{-1};
+};
+// main()里建好, 之后不再增减
+static std::vector<std::unique_ptr<Channel>> channels;
+
+/**
+ * @brief 一个采集设备或者一个--input的wav, 交织的num_channels个声道是channels[first_channel...]
+ *        每个设备的时钟不一样, 快的那个设备的audio_ring会慢慢积压, 满了就丢一个hop
+ */
+struct CaptureDevice {
+    // 设备(或者wav)的采样率, 开始采集之前设置
+    float rate{kSampleRate};
+    // rate != kSampleRate时流式重采样, 以前由miniaudio的后端重采样, 质量和延迟都不知道
+    bool resample{};
+    size_t first_channel{};
+    size_t num_channels{1};
+    // 只有音频回调访问, 这次回调凑齐的hop都记这个时间
+    int64_t callback_ns{};
+    ma_device device;
+    // --input的wav, 交织的
+    std::vector<float> input;
+};
+static std::vector<std::unique_ptr<CaptureDevice>> capture_devices;
+// 各阶段的耗时, 每个直方图只有一个线程写
+static qwqdsp::pitch::LatencyStats latency_stats;
+
+static void PushCaptureSample(Channel& channel, float v, int64_t callback_ns) {
+    channel.capture_hop.samples[channel.capture_filled++] = v;
+    if (channel.capture_filled == kHopSize) {
+        channel.capture_hop.first_sample = channel.capture_samples;
+        channel.capture_hop.capture_ns = callback_ns;
+        channel.audio_ring.Push({&channel.capture_hop, 1});
+        channel.capture_samples += kHopSize;
+        channel.capture_filled = 0;
+    }
+}
+
+/**
+ * @brief 一个设备的一块交织的音频, 拆成声道分别重采样凑hop
+ */
+static void CaptureBlock(CaptureDevice& device, const float* input, size_t num_frames) {
+    // 一次拆这么多帧, 回调里不分配内存
+    constexpr size_t kBlockSize = 256;
+    device.callback_ns = qwqdsp::pitch::LatencyHistogram::NowNs();
+    float block[kBlockSize];
+    for (size_t pos = 0; pos < num_frames; pos += kBlockSize) {
+        const size_t num = std::min(kBlockSize, num_frames - pos);
+        for (size_t c = 0; c < device.num_channels; ++c) {
+            Channel& channel = *channels[device.first_channel + c];
+            for (size_t i = 0; i < num; ++i) {
+                block[i] = input[(pos + i) * device.num_channels + c];
+            }
+            auto push = [&channel, &device](float v) {
+                PushCaptureSample(channel, v, device.callback_ns);
+            };
+            if (device.resample) {
+                channel.resampler.Process(std::span<const float>{block, num}, push);
+            }
+            else {
+                std::for_each(block, block + num, push);
+            }
+        }
+    }
+}
+
+void MyAudioCallback(ma_device *pDevice, void *pOutput, const void *pInput, ma_uint32 frameCount) {
+    CaptureBlock(*static_cast<CaptureDevice*>(pDevice->pUserData), static_cast<const float*>(pInput), frameCount);
+}
+
+/**
+ * @brief 重采样的延迟, kSampleRate的采样: 滤波器的群延迟 + 流式Process()等的1个输入采样
+ */
+static float GetResamplerLatency(const CaptureDevice& device) {
+    if (!device.resample) return 0.0f;
+    return (channels[device.first_channel]->resampler.GetGroupDelay() + 1.0f) * kSampleRate / device.rate;
+}
 
 static float FreqToY(float freq) {
     static float min_pitch = std::log(20.0f);
@@ -47,50 +195,303 @@ static float FreqToY(float freq) {
 
 static RenderTexture2D texture_spectrum;
 static RenderTexture2D texture_spectrum2;
+
+// -------------------- 分析线程 --------------------
+// 逐hop(16kHz下62.5Hz)从每个声道的audio_ring读音频, 算频谱和音高, 结果放进result_ring, 和30fps的画图无关
+// 所有声道一起一个hop一个hop地前进, 丢掉的hop当作静音补上, 所以每个声道第n个hop都是它的Viterbi的第n帧
+// 显示声道0的频谱
 static qwqdsp::spectral::ReassignmentCorrect fft;
 
-static float audio_segement[1024]{};
+// 每个hop只做一次FFT: 同一份频谱既是模型的输入, 又是显示的频谱
+// front_end和门限没有跨帧的状态, 所有声道共用
+static qwqdsp::pitch::SwiftF0FrontEnd front_end;
+static qwqdsp::pitch::SilenceGate gate;
+static qwqdsp::pitch::GateStats gate_stats;
 
 constexpr auto kModelPath = L"../../model.onnx";
+// quantize.py生成, --int8选择它, 只有onnxruntime能运行
+constexpr auto kInt8ModelPath = L"../../model_int8.onnx";
+
+// batch是声道数, 一次推理所有声道
+#ifdef SWIFT_F0_NATIVE
+static qwqdsp::pitch::NativePitchDetector pitch_detector;
+// [channels][kPitchFrames][kNumFreqs]
+static std::vector<float> model_input;
+#else
+static qwqdsp::pitch::PitchDetector pitch_detector;
+#endif
+
+/**
+ * @brief 一个声道在一个hop的结果
+ */
+struct ChannelResult {
+    // 这个hop的音频被丢掉了, 当作静音分析
+    bool dropped;
+    // 音频回调的时间, dropped时没有意义
+    int64_t capture_ns;
+    // 到这个hop为止Viterbi输出的最后一帧, 有延迟, output.sample比hop_sample早
+    qwqdsp::pitch::PitchFrame output;
+};
+
+/**
+ * @brief 所有声道一个hop的分析结果, 画图线程画成一列
+ */
+struct HopResult {
+    // 这个hop第一个采样在采集流里的位置
+    uint64_t hop_sample;
+    size_t num_channels;
+    // 模型运行了, 所有声道都被门限跳过或者丢掉时没有
+    bool inferred;
+    // 分析线程开始这个hop, 推理开始, 推理结束的时间
+    int64_t ready_ns;
+    int64_t inference_start_ns;
+    int64_t inference_end_ns;
+    ChannelResult channels[kMaxChannels];
+    // 声道0最新一帧频率重分配之后的显示频谱
+    float gains[kNumBins];
+    float freqs[kNumBins];
+};
+// 1s, 画图线程停下来(比如拖动窗口)超过它才会丢结果
+constexpr size_t kResultRingSize = 64;
+static qwqdsp::segement::SpscRing<HopResult> result_ring;
+static std::atomic<bool> analysis_running{false};
+
+// --sink=..., 取出result_ring的线程写, 每个声道的每个Viterbi帧写一次
+static std::vector<std::unique_ptr<qwqdsp::pitch::PitchSink>> sinks;
+
+static void WritePitch(Channel& channel, const qwqdsp::pitch::PitchFrame& frame) {
+    if (frame.frame <= channel.last_written_frame) return;
+    channel.last_written_frame = frame.frame;
+    for (auto& sink : sinks) {
+        sink->Write(frame);
+    }
+}
 
-static float ProcessPitch() {
-    static Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "SwiftF0");
-    static Ort::SessionOptions session_options;
-    static Ort::Session session(env, kModelPath, session_options);
-    Ort::MemoryInfo memory_info = Ort::MemoryInfo::CreateCpu(
-        OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
-
-    auto input_name = session.GetInputNames().front();
-    auto output_name = session.GetOutputNames();
- 
-    int64_t batch_size = 1;  
-    int64_t input_shape[]{batch_size, static_cast<int64_t>(kFftSize)}; 
-
-    Ort::Value input_tensor = Ort::Value::CreateTensor<float>(
-        memory_info, audio_segement, kFftSize,
-        input_shape, 2);
-
-    const char* input_names[] = {input_name.c_str()};
-    const char* output_names[] = {output_name[0].c_str(), output_name[1].c_str()};
-
-    auto output_tensors = session.Run(
-        Ort::RunOptions{},
-        input_names, &input_tensor, 1,
-        output_names, 2
-    );
-
-    auto* pitch_ptr = output_tensors[0].GetTensorMutableData<float>();
-    auto* confidence_ptr = output_tensors[1].GetTensorMutableData<float>();
-    auto max_confidence_it = std::max_element(confidence_ptr, confidence_ptr + 4);
-    size_t idx = max_confidence_it - confidence_ptr;
-    if (*max_confidence_it > kConfidence) {
-        return pitch_ptr[idx];
+/**
+ * @brief 画图线程或者无窗口模式的主线程取到一个结果
+ */
+static void PublishResult(const HopResult& result) {
+    const int64_t now = qwqdsp::pitch::LatencyHistogram::NowNs();
+    bool any_audio = false;
+    for (size_t c = 0; c < result.num_channels; ++c) {
+        const ChannelResult& channel_result = result.channels[c];
+        if (!channel_result.dropped) {
+            any_audio = true;
+            // 每个声道的采集时间不同, 总延迟按声道记
+            latency_stats.stages[qwqdsp::pitch::LatencyStats::kTotal].Record(now - channel_result.capture_ns);
+        }
+        WritePitch(*channels[c], channel_result.output);
+    }
+    // 和kFrontEnd/kInference一样每个hop只记一次
+    if (any_audio) {
+        latency_stats.stages[qwqdsp::pitch::LatencyStats::kPublish].Record(now - result.inference_end_ns);
+    }
+}
+
+/**
+ * @brief 新的一个hop在analysis_frame的末尾, 算一帧log|STFT|追加到log_magnitude
+ */
+static void ProcessFrontEnd(Channel& channel) {
+    using FrontEnd = qwqdsp::pitch::SwiftF0FrontEnd;
+    std::copy(std::begin(channel.log_magnitude) + FrontEnd::kNumFreqs, std::end(channel.log_magnitude),
+              std::begin(channel.log_magnitude));
+    front_end.ProcessFrame(channel.analysis_frame, std::end(channel.log_magnitude) - FrontEnd::kNumFreqs);
+    std::copy(std::begin(channel.column_silent) + 1, std::end(channel.column_silent), std::begin(channel.column_silent));
+    channel.column_silent[kPitchFrames - 1] = gate.IsSilent(front_end.GetSpectrum());
+}
+
+static bool IsSilent(const Channel& channel) {
+    return std::all_of(std::begin(channel.column_silent), std::end(channel.column_silent), [](bool b) { return b; });
+}
+
+/**
+ * @return Viterbi的回调, 输出写进channel.viterbi_output
+ */
+static auto OnViterbiFrame(Channel& channel) {
+    return [&channel](size_t frame, float pitch, float confidence) {
+        auto& output = channel.viterbi_output;
+        output.frame = static_cast<int64_t>(frame);
+        // 流式推理的帧下标就是离线推理的帧下标, 中心在frame * kHopSize
+        // 否则Viterbi的第n帧是第n个hop, 中心在(n - 1) * kHopSize
+        output.sample = (output.frame - (kStreamingPitch ? 0 : 1)) * static_cast<int64_t>(kHopSize)
+                      - channel.resampler_latency_samples;
+        output.pitch = pitch;
+        output.confidence = confidence;
+    };
+}
+
+/**
+ * @brief 所有声道的log_magnitude叠成{channels, kPitchFrames, kNumFreqs}, 一次推理
+ *        batch固定是声道数, 门限跳过的声道也在里面: 改batch要重新分配和绑定缓冲区
+ */
+static void RunModel() {
+#ifdef SWIFT_F0_NATIVE
+    float* input = model_input.data();
+#else
+    float* input = pitch_detector.GetInput().data();
+#endif
+    for (size_t c = 0; c < channels.size(); ++c) {
+        std::copy(std::begin(channels[c]->log_magnitude), std::end(channels[c]->log_magnitude),
+                  input + c * kLogMagnitudeSize);
+    }
+#ifdef SWIFT_F0_NATIVE
+    pitch_detector.ProcessLogMagnitude(model_input, channels.size());
+#else
+    pitch_detector.Process();
+#endif
+}
+
+/**
+ * @brief 一个声道这个hop的结果送进它的Viterbi, needs_model时RunModel()已经运行过了
+ * @param index 声道下标, 也是batch里的下标
+ */
+static void ProcessPitch(Channel& channel, size_t index, bool dropped) {
+    if (dropped) {
+        channel.column_silent[kPitchFrames - 1] = true;
+        channel.viterbi.PushUnvoiced(OnViterbiFrame(channel));
+        return;
+    }
+    const bool silent = IsSilent(channel);
+    if (!channel.needs_model) {
+        gate_stats.Add(true, false, false);
+        channel.viterbi.PushUnvoiced(OnViterbiFrame(channel));
+        return;
+    }
+
+    auto confidence = pitch_detector.GetConfidence().subspan(index * kPitchFrames, kPitchFrames);
+    const bool voiced = *std::max_element(confidence.begin(), confidence.end()) > kConfidence;
+    gate_stats.Add(silent, true, voiced);
+
+    // 每个hop送最新的一帧进Viterbi
+    if (silent) {
+        channel.viterbi.PushUnvoiced(OnViterbiFrame(channel));
     }
     else {
-        return 0;
+        constexpr size_t kNumPitchBins = qwqdsp::pitch::StreamingViterbi::kNumPitchBins;
+        channel.viterbi.Push(pitch_detector.GetProbabilities().subspan(
+                                 ((index + 1) * kPitchFrames - 1) * kNumPitchBins, kNumPitchBins),
+                             OnViterbiFrame(channel));
     }
 }
 
+static void ProcessPitchStreaming(Channel& channel, std::span<const float> hop) {
+    channel.streaming_detector.Process(hop, [&channel](size_t, float, float) {
+        channel.viterbi.Push(channel.streaming_detector.GetProbabilities(), OnViterbiFrame(channel));
+    });
+}
+
+// 下一个该分析的hop的第一个采样, 所有声道一起前进
+static uint64_t next_hop_sample{};
+
+/**
+ * @brief 每个声道从audio_ring取一个hop等着分析
+ *        比next_hop_sample早的hop来得太晚, 已经当作丢掉的分析过了, 扔掉
+ * @return 每个声道都有等着的hop
+ */
+static bool FillPending() {
+    bool all = true;
+    for (auto& channel : channels) {
+        while (!channel->has_pending && channel->audio_ring.Pop({&channel->pending, 1})) {
+            channel->has_pending = channel->pending.first_sample >= next_hop_sample;
+        }
+        all = all && channel->has_pending;
+    }
+    return all;
+}
+
+/**
+ * @brief 有一个声道积压了半个audio_ring, 其他声道的设备大概停了, 不再等它们
+ */
+static bool IsBacklogged() {
+    return std::any_of(channels.begin(), channels.end(), [](const auto& channel) {
+        return channel->audio_ring.GetNumReadable() >= kAudioRingSize / 2;
+    });
+}
+
+/**
+ * @brief 分析所有声道在next_hop_sample的hop, 等着的hop不是这个位置的声道当作丢掉
+ */
+static void AnalyseHop(HopResult& result) {
+    using Latency = qwqdsp::pitch::LatencyStats;
+    result.ready_ns = qwqdsp::pitch::LatencyHistogram::NowNs();
+    result.hop_sample = next_hop_sample;
+    result.num_channels = channels.size();
+    bool any_audio = false;
+    bool any_model = false;
+    for (size_t c = 0; c < channels.size(); ++c) {
+        Channel& channel = *channels[c];
+        ChannelResult& channel_result = result.channels[c];
+        channel_result.dropped = !channel.has_pending || channel.pending.first_sample != next_hop_sample;
+        float* hop = channel.analysis_frame + kFftSize - kHopSize;
+        if (!channel_result.dropped) {
+            std::copy_n(channel.pending.samples, kHopSize, hop);
+            channel_result.capture_ns = channel.pending.capture_ns;
+            channel.has_pending = false;
+            latency_stats.stages[Latency::kQueue].Record(result.ready_ns - channel_result.capture_ns);
+            any_audio = true;
+        }
+        else {
+            std::fill_n(hop, kHopSize, 0.0f);
+        }
+
+        ProcessFrontEnd(channel);
+        if (c == 0) {
+            // 最新一帧的加窗频谱front_end算过了, 这里只补算频率重分配需要的那一个FFT
+            fft.Process(channel.analysis_frame, front_end.GetSpectrum());
+            fft.GetFrequency(result.freqs);
+            fft.GetGain(result.gains);
+        }
+        channel.needs_model = !kStreamingPitch && !channel_result.dropped
+                            && (!IsSilent(channel) || gate.GetConfig().audit);
+        any_model = any_model || channel.needs_model;
+    }
+
+    result.inference_start_ns = qwqdsp::pitch::LatencyHistogram::NowNs();
+    if (kStreamingPitch) {
+        // 流式推理的卷积历史也要补上丢掉的静音, 帧下标才对得上
+        for (auto& channel : channels) {
+            ProcessPitchStreaming(*channel, {channel->analysis_frame + kFftSize - kHopSize, kHopSize});
+        }
+    }
+    else {
+        if (any_model) {
+            RunModel();
+        }
+        for (size_t c = 0; c < channels.size(); ++c) {
+            ProcessPitch(*channels[c], c, result.channels[c].dropped);
+        }
+    }
+    result.inferred = kStreamingPitch || any_model;
+    result.inference_end_ns = qwqdsp::pitch::LatencyHistogram::NowNs();
+
+    if (any_audio) {
+        latency_stats.stages[Latency::kFrontEnd].Record(result.inference_start_ns - result.ready_ns);
+        if (result.inferred) {
+            latency_stats.stages[Latency::kInference].Record(result.inference_end_ns - result.inference_start_ns);
+        }
+    }
+    for (size_t c = 0; c < channels.size(); ++c) {
+        Channel& channel = *channels[c];
+        result.channels[c].output = channel.viterbi_output;
+        std::copy(channel.analysis_frame + kHopSize, channel.analysis_frame + kFftSize, channel.analysis_frame);
+    }
+    result_ring.Push({&result, 1});
+    next_hop_sample += kHopSize;
+}
+
+static void AnalysisThread() {
+    static HopResult result;
+    while (analysis_running.load(std::memory_order_relaxed)) {
+        if (!FillPending() && !IsBacklogged()) {
+            // 音频回调不能通知, 还有声道没到就等一小段, 比一个hop(16ms)短得多
+            std::this_thread::sleep_for(std::chrono::milliseconds{2});
+            continue;
+        }
+        AnalyseHop(result);
+    }
+}
+
+// -------------------- 画图线程 --------------------
 static Color GetSpectrumColor(float normal) {
     normal = fmaxf(0.0f, fminf(1.0f, normal));
     
@@ -112,53 +513,51 @@ static Color GetSpectrumColor(float normal) {
     }
 }
 
-static void DrawSpectrumAndPitch() {
-    {
-        audio_lock.acquire();
-        size_t rpos = wpos - 1 - kFftSize;
-        for (size_t i = 0; i < kFftSize; ++i) {
-            rpos &= 2047;
-            audio_segement[i] = audio_buffer[rpos++];
-        }
-        audio_lock.release();
-    }
+// 每个声道音高的颜色
+static const Color kChannelColors[kMaxChannels]{WHITE, GREEN, ORANGE, SKYBLUE, PINK, GOLD, LIME, VIOLET};
 
+/**
+ * @brief 一个hop画一列, 图像向左滚动一个像素
+ */
+static void DrawColumn(const HopResult& result) {
+    const bool unvoiced = std::all_of(result.channels, result.channels + result.num_channels,
+                                      [](const ChannelResult& r) { return r.output.pitch == 0.0f; });
     BeginTextureMode(texture_spectrum);
         ClearBackground(BLANK);
-        float pitch = ProcessPitch();
-        if (pitch == 0.0f) {
+        if (result.channels[0].dropped) {
+            auto x = texture_spectrum.texture.width - 1;
+            DrawLine(x, 0, x, kImageHeight, Color{96,0,0,255});
+        }
+        else if (unvoiced) {
             auto x = texture_spectrum.texture.width - 1;
             DrawLine(x, 0, x, kImageHeight, Color{32,32,32,255});
         }
         DrawTexture(texture_spectrum2.texture, 0, 0, WHITE);
 
         // draw spectrum
-        fft.Process(audio_segement);
-        float gains[kNumBins]{};
-        float freqs[kNumBins]{};
-        fft.GetFrequency(freqs);
-        fft.GetGain(gains);
         float filter[kImageHeight]{};
         for (size_t j = 0; j < kNumBins; ++j) {
-            if (!std::isfinite(freqs[j])) continue;
+            if (!std::isfinite(result.freqs[j])) continue;
 
             float db = kSpectrumFloorDb;
-            if (gains[j] > min_db_gain) {
-                db = 20.0f * std::log10(gains[j]);
+            if (result.gains[j] > min_db_gain) {
+                db = 20.0f * std::log10(result.gains[j]);
             }
             float gain_normal = (db - kSpectrumFloorDb) / (kSpectrumTopDb - kSpectrumFloorDb);
             auto color = GetSpectrumColor(gain_normal);
-            size_t idx = FreqToY(freqs[j] * kSampleRate);
-            if (gains[j] > filter[idx]) {
-                filter[idx] = gains[j];
+            size_t idx = FreqToY(result.freqs[j] * kSampleRate);
+            if (result.gains[j] > filter[idx]) {
+                filter[idx] = result.gains[j];
                 DrawPixel(texture_spectrum.texture.width - 1, idx, color);
             }
         }
         // draw pitch
-        if (pitch != 0.0f) {
+        for (size_t c = 0; c < result.num_channels; ++c) {
+            const float pitch = result.channels[c].output.pitch;
+            if (pitch == 0.0f) continue;
             size_t idx = FreqToY(pitch);
             DrawPixel(texture_spectrum.texture.width - 1, idx + 1, BLACK);
-            DrawPixel(texture_spectrum.texture.width - 1, idx, WHITE);
+            DrawPixel(texture_spectrum.texture.width - 1, idx, kChannelColors[c]);
             DrawPixel(texture_spectrum.texture.width - 1, idx - 1, BLACK);
         }
     EndTextureMode();
@@ -167,57 +566,414 @@ static void DrawSpectrumAndPitch() {
         ClearBackground(BLANK);
         DrawTextureRec(texture_spectrum.texture, {1, 0, (float)texture_spectrum.texture.width-1, (float)texture_spectrum.texture.height}, {0, 0}, WHITE);
     EndTextureMode();
+}
 
+static void DrawSpectrumAndPitch() {
+    // 画完上一帧之后分析线程发布的所有hop
+    static HopResult result;
+    while (result_ring.Pop({&result, 1})) {
+        DrawColumn(result);
+        PublishResult(result);
+    }
     DrawTexturePro(texture_spectrum.texture, Rectangle{0,0,(float)texture_spectrum.texture.width, (float)texture_spectrum.texture.height}, Rectangle{0,0,(float)kWindowWidth,(float)kWindowHeight}, Vector2{0,0}, 0, WHITE);
+
+    // 各阶段耗时
+    char line[128];
+    for (int i = 0; i < qwqdsp::pitch::LatencyStats::kNumStages; ++i) {
+        latency_stats.Format(static_cast<qwqdsp::pitch::LatencyStats::Stage>(i), line, sizeof(line));
+        DrawText(line, 8, 8 + 14 * i, 10, LIGHTGRAY);
+    }
 }
 
 static ma_context audio_context;
-static ma_device audio_device;
+
+// -------------------- 无窗口模式 --------------------
+// Ctrl+C或者--input的文件都读完时停止
+static std::atomic<bool> stop_requested{false};
+static std::atomic<bool> capture_done{false};
+// 还没读完的--input
+static std::atomic<size_t> captures_running{0};
+
+static void OnSignal(int) {
+    stop_requested = true;
+}
+
+/**
+ * @brief 代替声卡, 把一个wav按采集的时间节奏送进CaptureBlock
+ * @param speed 几倍速, 0: 不等待, 分析跟不上时会丢hop
+ */
+static void FileCaptureThread(CaptureDevice& device, float speed) {
+    // 10ms, 和一般声卡的回调差不多大
+    constexpr size_t kBlockSize = 160;
+    const size_t num_frames = device.input.size() / device.num_channels;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; pos < num_frames && !stop_requested; pos += kBlockSize) {
+        const size_t num = std::min(kBlockSize, num_frames - pos);
+        CaptureBlock(device, device.input.data() + pos * device.num_channels, num);
+        if (speed > 0) {
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>{(pos + num) / (device.rate * speed)}));
+        }
+    }
+    if (--captures_running == 0) {
+        capture_done = true;
+    }
+}
+
+/**
+ * @brief 分析线程和FileCaptureThread都停了以后调用
+ *        分析还等着的hop, 补上最后丢掉的hop(后面没有hop了, 分析线程发现不了), 一直到最长的那个声道
+ *        然后输出Viterbi(和流式推理)还在延迟里的帧
+ */
+static void FlushPitch() {
+    static HopResult result;
+    uint64_t end = 0;
+    for (const auto& channel : channels) {
+        end = std::max(end, channel->capture_samples);
+    }
+    while (next_hop_sample < end) {
+        FillPending();
+        AnalyseHop(result);
+        while (result_ring.Pop({&result, 1})) {
+            PublishResult(result);
+        }
+    }
+    for (auto& channel_ptr : channels) {
+        Channel& channel = *channel_ptr;
+        if (kStreamingPitch) {
+            channel.streaming_detector.Flush([&channel](size_t, float, float) {
+                channel.viterbi.Push(channel.streaming_detector.GetProbabilities(), OnViterbiFrame(channel));
+                WritePitch(channel, channel.viterbi_output);
+            });
+        }
+        channel.viterbi.Flush([&channel](size_t frame, float pitch, float confidence) {
+            OnViterbiFrame(channel)(frame, pitch, confidence);
+            WritePitch(channel, channel.viterbi_output);
+        });
+    }
+}
+
+static void RunHeadless() {
+    static HopResult result;
+    for (;;) {
+        while (result_ring.Pop({&result, 1})) {
+            PublishResult(result);
+        }
+        if (stop_requested) break;
+        // 分析线程可能还在算最后一个hop, 停下以后会再取一次result_ring
+        if (capture_done && std::all_of(channels.begin(), channels.end(), [](const auto& channel) {
+                return channel->audio_ring.GetNumReadable() == 0;
+            })) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds{5});
+    }
+}
+
+/**
+ * @brief 不重采样, 和声卡一样按文件的采样率送进CaptureBlock, 所有声道交织
+ */
+static bool LoadAudio(const char* path, CaptureDevice& device) {
+    AudioFile<float> infile;
+    if (!infile.load(path)) {
+        return false;
+    }
+    device.rate = static_cast<float>(infile.getSampleRate());
+    device.num_channels = static_cast<size_t>(infile.getNumChannels());
+    const size_t num_frames = static_cast<size_t>(infile.getNumSamplesPerChannel());
+    device.input.resize(num_frames * device.num_channels);
+    for (size_t c = 0; c < device.num_channels; ++c) {
+        for (size_t i = 0; i < num_frames; ++i) {
+            device.input[i * device.num_channels + c] = infile.samples[c][i];
+        }
+    }
+    return true;
+}
+
+static void PrintLatencyBudget() {
+    const float ms_per_sample = 1000.0f / kSampleRate;
+    // 凑齐一个hop才分析, 平均等半个hop
+    const float hop = kHopSize * ms_per_sample;
+    float model;
+    if (kStreamingPitch) {
+        model = channels.front()->streaming_detector.GetLatencySamples() * ms_per_sample;
+    }
+    else {
+        // 最新一帧窗口的中心在最后一个采样之前半个窗口
+        model = kFftSize / 2 * ms_per_sample;
+    }
+    const float decoder = channels.front()->viterbi.GetLatencyFrames() * kHopSize * ms_per_sample;
+    for (const auto& device : capture_devices) {
+        const float resampler = GetResamplerLatency(*device) * ms_per_sample;
+        std::fprintf(stderr, "latency budget: capture %gHz x %zu, resampler %.2fms + hop <=%.1fms + model %.1fms + viterbi %.1fms = <=%.1fms\n",
+            device->rate, device->num_channels, resampler, hop, model, decoder, resampler + hop + model + decoder);
+    }
+}
+
+// set this index to your capture device, --device=N
+constexpr int kCaptureDevice = 1;
+
+static constexpr const char* kUsage =
+    "  --headless\n"
+    "  --input=a.wav (repeatable)\n"
+    "  --input-speed=X\n"
+    "  --backend=default|null\n"
+    "  --device=N (repeatable)\n"
+    "  --channels=N\n";
 
 int main(int argc, char const *argv[]) {
-    if (ma_context_init(NULL, 0, NULL, &audio_context) != MA_SUCCESS) {
+    qwqdsp::pitch::GateConfig gate_config;
+    bool headless = false;
+    std::vector<const char*> input_paths;
+    float input_speed = 1.0f;
+    bool null_backend = false;
+    std::vector<int> capture_device_indices;
+    // 每个设备采集几个声道
+    size_t device_channels = 1;
+    std::vector<std::string_view> sink_specs;
+#ifndef SWIFT_F0_NATIVE
+    qwqdsp::pitch::SessionConfig session_config;
+    auto model_path = kModelPath;
+#endif
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg{argv[i]};
+        if (gate_config.ParseArgument(arg)) {
+            continue;
+        }
+        if (arg == "--headless") {
+            headless = true;
+            continue;
+        }
+        if (arg.starts_with("--sink=")) {
+            sink_specs.push_back(arg.substr(7));
+            continue;
+        }
+        if (arg.starts_with("--input=")) {
+            input_paths.push_back(argv[i] + 8);
+            continue;
+        }
+        if (arg.starts_with("--input-speed=")) {
+            input_speed = std::strtof(argv[i] + 14, nullptr);
+            continue;
+        }
+        if (arg == "--backend=null" || arg == "--backend=default") {
+            null_backend = arg == "--backend=null";
+            continue;
+        }
+        if (arg.starts_with("--device=")) {
+            capture_device_indices.push_back(std::atoi(argv[i] + 9));
+            continue;
+        }
+        if (arg.starts_with("--channels=")) {
+            device_channels = static_cast<size_t>(std::max(1, std::atoi(argv[i] + 11)));
+            continue;
+        }
+#ifndef SWIFT_F0_NATIVE
+        if (arg == "--int8") {
+            model_path = kInt8ModelPath;
+            continue;
+        }
+        if (session_config.ParseArgument(arg)) {
+            continue;
+        }
+        std::fprintf(stderr, "bad option %s\n  --int8\n%s%s%s%s", argv[i], kUsage, qwqdsp::pitch::PitchSink::kUsage,
+            qwqdsp::pitch::SessionConfig::kUsage, qwqdsp::pitch::GateConfig::kUsage);
+#else
+        std::fprintf(stderr, "bad option %s\n%s%s%s", argv[i], kUsage, qwqdsp::pitch::PitchSink::kUsage,
+            qwqdsp::pitch::GateConfig::kUsage);
+#endif
         return -1;
     }
+    if (capture_device_indices.empty()) {
+        capture_device_indices.push_back(kCaptureDevice);
+    }
 
-    ma_device_info *pPlaybackInfos;
-    ma_uint32 playbackCount;
-    ma_device_info *pCaptureInfos;
-    ma_uint32 captureCount;
-    if (ma_context_get_devices(&audio_context, &pPlaybackInfos, &playbackCount, &pCaptureInfos, &captureCount) != MA_SUCCESS) {
-        return 1;
+    // 没有指定输出时, 无窗口模式写到stdout
+    if (headless && sink_specs.empty()) {
+        sink_specs.push_back("stdout");
+    }
+    for (auto spec : sink_specs) {
+        auto& sink = sinks.emplace_back(std::make_unique<qwqdsp::pitch::PitchSink>());
+        if (!sink->Open(spec, kSampleRate)) {
+            std::fprintf(stderr, "can not open sink %.*s\n", static_cast<int>(spec.size()), spec.data());
+            return -1;
+        }
     }
 
-    ma_device_config config;
-    config = ma_device_config_init(ma_device_type_capture);
-    config.capture.format = ma_format_f32;
-    config.capture.channels = 1;
-    config.sampleRate = kSampleRate;
-    config.dataCallback = MyAudioCallback;
-    config.pUserData = nullptr;
-    // set this index to your capture device  ↓
-    config.capture.pDeviceID = &pCaptureInfos[1].id;
+    // 每个wav或者设备的声道依次编号
+    size_t num_channels = 0;
+    if (!input_paths.empty()) {
+        for (const char* path : input_paths) {
+            auto& device = *capture_devices.emplace_back(std::make_unique<CaptureDevice>());
+            if (!LoadAudio(path, device)) {
+                std::fprintf(stderr, "can not load %s\n", path);
+                return -1;
+            }
+            device.first_channel = num_channels;
+            num_channels += device.num_channels;
+        }
+    }
+    else {
+        // 没有声卡的机器用null后端测试, 它按时间节奏产生静音
+        ma_backend backends[]{ma_backend_null};
+        if (ma_context_init(null_backend ? backends : NULL, null_backend ? 1 : 0, NULL, &audio_context) != MA_SUCCESS) {
+            return -1;
+        }
 
-    if (ma_device_init(NULL, &config, &audio_device) != MA_SUCCESS) {
+        ma_device_info *pPlaybackInfos;
+        ma_uint32 playbackCount;
+        ma_device_info *pCaptureInfos;
+        ma_uint32 captureCount;
+        if (ma_context_get_devices(&audio_context, &pPlaybackInfos, &playbackCount, &pCaptureInfos, &captureCount) != MA_SUCCESS) {
+            return 1;
+        }
+
+        for (int index : capture_device_indices) {
+            auto& device = *capture_devices.emplace_back(std::make_unique<CaptureDevice>());
+            ma_device_config config;
+            config = ma_device_config_init(ma_device_type_capture);
+            config.capture.format = ma_format_f32;
+            config.capture.channels = static_cast<ma_uint32>(device_channels);
+            // 0: 设备自己的采样率, miniaudio不重采样
+            config.sampleRate = 0;
+            config.dataCallback = MyAudioCallback;
+            config.pUserData = &device;
+            if (index >= 0 && static_cast<ma_uint32>(index) < captureCount) {
+                config.capture.pDeviceID = &pCaptureInfos[index].id;
+            }
+            else {
+                std::fprintf(stderr, "no capture device %d, using the default one\n", index);
+            }
+
+            if (ma_device_init(&audio_context, &config, &device.device) != MA_SUCCESS) {
+                return -1;
+            }
+            device.rate = static_cast<float>(device.device.sampleRate);
+            device.num_channels = device_channels;
+            device.first_channel = num_channels;
+            num_channels += device.num_channels;
+        }
+    }
+    if (num_channels > kMaxChannels) {
+        std::fprintf(stderr, "%zu channels, at most %zu\n", num_channels, kMaxChannels);
         return -1;
     }
-    ma_device_start(&audio_device);
+    for (size_t c = 0; c < num_channels; ++c) {
+        channels.emplace_back(std::make_unique<Channel>());
+    }
+    for (const auto& device : capture_devices) {
+        device->resample = device->rate != kSampleRate;
+        for (size_t c = 0; c < device->num_channels; ++c) {
+            Channel& channel = *channels[device->first_channel + c];
+            channel.audio_ring.Init(kAudioRingSize);
+            if (device->resample) {
+                channel.resampler.Init(device->rate, kSampleRate);
+            }
+            channel.resampler_latency_samples = static_cast<int64_t>(std::lround(GetResamplerLatency(*device)));
+            channel.viterbi_output.channel = static_cast<int32_t>(device->first_channel + c);
+        }
+    }
 
-    InitWindow(kWindowWidth, kWindowHeight, "SwiftF0 realtime");
-    SetTargetFPS(30);
+    if (!headless) {
+        InitWindow(kWindowWidth, kWindowHeight, "SwiftF0 realtime");
+        SetTargetFPS(30);
 
-    texture_spectrum = LoadRenderTexture(kImageWidth, kImageHeight);
-    texture_spectrum2 = LoadRenderTexture(kImageWidth, kImageHeight);
+        texture_spectrum = LoadRenderTexture(kImageWidth, kImageHeight);
+        texture_spectrum2 = LoadRenderTexture(kImageWidth, kImageHeight);
+    }
+    // int8模型的窗和音高bin和float模型一样, 从float模型读取
+    qwqdsp::pitch::SwiftF0Weights weights;
+    if (!weights.Load(kModelPath)) {
+        return -1;
+    }
+    front_end.Init(weights.window);
+    gate.Init(front_end.GetWindow(), gate_config);
     fft.Init(kFftSize);
+    // 显示也用模型的Hann窗, 才能复用front_end的频谱
+    fft.ChangeWindow([](auto win, auto dwin) {
+        std::copy(front_end.GetWindow().begin(), front_end.GetWindow().end(), win.begin());
+        qwqdsp::window::Hann::DWindow(dwin);
+    });
+#ifdef SWIFT_F0_NATIVE
+    pitch_detector.Init(weights);
+    model_input.resize(num_channels * kLogMagnitudeSize);
+#else
+    pitch_detector.Init(model_path, kPitchFrames, num_channels, session_config,
+                        qwqdsp::pitch::PitchDetector::InputType::kLogMagnitude, true);
+#endif
+    for (auto& channel : channels) {
+        channel->viterbi.Init(weights.pitch_bin_centers, {});
+        if (kStreamingPitch) {
+            channel->streaming_detector.Init(weights);
+        }
+    }
+    result_ring.Init(kResultRingSize);
+    PrintLatencyBudget();
+    analysis_running = true;
+    std::thread analysis_thread{AnalysisThread};
+    // 模型加载完再开始采集, 不然加载期间audio_ring就满了
+    std::vector<std::thread> file_capture_threads;
+    if (!input_paths.empty()) {
+        captures_running = capture_devices.size();
+        for (auto& device : capture_devices) {
+            file_capture_threads.emplace_back(FileCaptureThread, std::ref(*device), input_speed);
+        }
+    }
+    else {
+        for (auto& device : capture_devices) {
+            ma_device_start(&device->device);
+        }
+    }
 
-    while (!WindowShouldClose()) {
-        BeginDrawing();
-        ClearBackground(BLACK);
-        DrawSpectrumAndPitch();
-        EndDrawing();
+    if (headless) {
+        std::signal(SIGINT, OnSignal);
+        std::signal(SIGTERM, OnSignal);
+        RunHeadless();
+    }
+    else {
+        while (!WindowShouldClose()) {
+            BeginDrawing();
+            ClearBackground(BLACK);
+            DrawSpectrumAndPitch();
+            EndDrawing();
+        }
     }
 
-    UnloadRenderTexture(texture_spectrum);
-    UnloadRenderTexture(texture_spectrum2);
-    CloseWindow();
-    ma_device_uninit(&audio_device);
+    stop_requested = true;
+    if (!input_paths.empty()) {
+        for (auto& thread : file_capture_threads) {
+            thread.join();
+        }
+    }
+    else {
+        for (auto& device : capture_devices) {
+            ma_device_uninit(&device->device);
+        }
+        ma_context_uninit(&audio_context);
+    }
+    analysis_running = false;
+    analysis_thread.join();
+    if (headless) {
+        RunHeadless();
+        if (capture_done) {
+            FlushPitch();
+        }
+    }
+    else {
+        UnloadRenderTexture(texture_spectrum);
+        UnloadRenderTexture(texture_spectrum2);
+        CloseWindow();
+    }
+    sinks.clear();
+
+    for (size_t c = 0; c < channels.size(); ++c) {
+        std::fprintf(stderr, "audio ring %zu: overruns=%zu dropped_hops=%zu\n",
+            c, channels[c]->audio_ring.GetNumOverruns(), channels[c]->audio_ring.GetNumDropped());
+    }
+    std::fprintf(stderr, "result ring: overruns=%zu dropped_hops=%zu\n",
+        result_ring.GetNumOverruns(), result_ring.GetNumDropped());
+    if (!kStreamingPitch) {
+        gate_stats.Print("gate", stderr);
+    }
+    latency_stats.Print(stderr);
 }
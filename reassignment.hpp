@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <complex>
 #include <cstddef>
 #include <numbers>
@@ -55,6 +56,20 @@ public:
         fft_.FFT(buffer_.data(), xth_data_.data());
     }
 
+    /**
+     * @brief 复用别处已经算好的加窗频谱, 只补算频率重分配需要的dwindow频谱
+     * @param xh time乘window之后的FFT, OourasRealFFT的输出格式, window必须和ChangeWindow()的一样
+     * @note 不计算twindow的频谱
+     */
+    void Process(std::span<const float> time, std::span<const float> xh) noexcept {
+        const size_t fft_size = fft_.GetFFTSize();
+        std::copy_n(xh.begin(), fft_size + 2, xh_data_.begin());
+        for (size_t i = 0; i < fft_size; ++i) {
+            buffer_[i] = time[i] * dwindow_[i];
+        }
+        fft_.FFT(buffer_.data(), xdh_data_.data());
+    }
+
     float GetFrequency(size_t idx) const noexcept {
         auto xdh = std::complex{xdh_data_[2*idx],xdh_data_[2*idx+1]} * dwindow_scale_;
         auto xh = std::complex{xh_data_[2*idx],xh_data_[2*idx+1]} * window_scale_;
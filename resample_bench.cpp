@@ -0,0 +1,103 @@
+// 长文件重采样到16kHz, 逐个push_back的输出和事先算好长度的输出的耗时, 以及多线程ResampleParallel()的耗时和误差
+// usage: swift_f0_resample_bench [a.wav | seconds] [max_threads]
+// 没有wav时生成seconds秒(默认3600)的48kHz正弦加噪声, max_threads默认是硬件线程数
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include "AudioFile.h"
+#include "resample_iir.hpp"
+#include "resample_coeffs.h"
+
+using Resampler = qwqdsp::fx::ResampleIIR<qwqdsp::fx::coeff::MedianCoeffs<float>, 127>;
+
+constexpr float kTargetRate = 16000.0f;
+
+template<class Func>
+static double MeasureMs(Func&& func) {
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char const *argv[]) {
+    std::vector<float> input;
+    float sample_rate = 48000.0f;
+    if (argc > 1 && std::strstr(argv[1], ".wav") != nullptr) {
+        AudioFile<float> infile;
+        if (!infile.load(argv[1])) {
+            std::printf("can not load %s\n", argv[1]);
+            return 1;
+        }
+        input = std::move(infile.samples.front());
+        sample_rate = static_cast<float>(infile.getSampleRate());
+    }
+    else {
+        const double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 3600.0;
+        input.resize(static_cast<size_t>(seconds * sample_rate));
+        std::mt19937 rng{1};
+        std::normal_distribution<float> noise{0.0f, 0.05f};
+        for (size_t i = 0; i < input.size(); ++i) {
+            input[i] = 0.3f * static_cast<float>(std::sin(2.0 * std::numbers::pi * 220.0 * i / sample_rate)) + noise(rng);
+        }
+    }
+
+    Resampler resampler;
+    resampler.Init(sample_rate, kTargetRate);
+    const size_t num_output = resampler.GetOutputSize(input.size());
+    std::printf("%zu samples at %gHz (%.0fs) -> %zu samples\n", input.size(), sample_rate,
+        input.size() / sample_rate, num_output);
+
+    // 以前的一次性Process(): 输出一个一个push_back, vector反复扩容复制
+    std::vector<float> grown;
+    const double grown_ms = MeasureMs([&] {
+        resampler.Reset();
+        resampler.Process(std::span<const float>{input}, [&grown](float v) {
+            grown.push_back(v);
+        });
+    });
+
+    // 长度事先算好, 只分配一次
+    std::vector<float> sized;
+    const double sized_ms = MeasureMs([&] {
+        sized = resampler.Process<float>(input);
+    });
+
+    // 调用者的缓冲区, 已经分配好, 不再分配
+    std::vector<float> caller(num_output);
+    const double caller_ms = MeasureMs([&] {
+        resampler.Resample(std::span<const float>{input}, std::span<float>{caller});
+    });
+
+    const bool same = grown.size() == num_output && sized.size() == num_output
+        && std::memcmp(grown.data(), sized.data(), num_output * sizeof(float)) == 0
+        && std::memcmp(grown.data(), caller.data(), num_output * sizeof(float)) == 0;
+    std::printf("push_back      %9.1fms\n", grown_ms);
+    std::printf("exact length   %9.1fms\n", sized_ms);
+    std::printf("caller buffer  %9.1fms\n", caller_ms);
+    std::printf("outputs %s\n", same ? "identical" : "DIFFERENT");
+
+    // 多线程, 和单线程的输出比较
+    const size_t max_threads = argc > 2 ? std::strtoull(argv[2], nullptr, 10)
+                                        : std::max<size_t>(1, std::thread::hardware_concurrency());
+    std::vector<float> parallel(num_output);
+    bool close = true;
+    for (size_t num_threads = 1; num_threads <= std::max<size_t>(max_threads, 2); num_threads *= 2) {
+        std::fill(parallel.begin(), parallel.end(), 0.0f);
+        const double parallel_ms = MeasureMs([&] {
+            resampler.ResampleParallel(std::span<const float>{input}, std::span<float>{parallel}, num_threads);
+        });
+        float max_error = 0.0f;
+        for (size_t i = 0; i < num_output; ++i) {
+            max_error = std::max(max_error, std::abs(parallel[i] - caller[i]));
+        }
+        close = close && max_error < 1e-5f;
+        std::printf("%2zu threads     %9.1fms  max error %g\n", num_threads, parallel_ms, max_error);
+    }
+    return same && close ? 0 : 1;
+}
@@ -1,4 +1,12 @@
 #pragma once
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <thread>
 #include <vector>
 #include <span>
 #include "elliptic_blep.hpp"
@@ -6,6 +14,8 @@
 namespace qwqdsp::fx {
 /**
  * @brief holters-parker IIR重采样器，使用Elliptic-blep库实现，移除了高通滤波器系数
+ *        第k个输出在输入的k * phase_num_ / phase_den_处, 相位用整数累加, 长时间也不会漂, 输出的个数可以直接算出来
+ *        source_fs是target_fs的整数倍(48k->16k, 32k->16k)时自动走整数倍降采样: 每M个输入推进一次滤波器, 只在输出时刻求值
  */
 template<class TCoeff, size_t kPartialStep>
 class ResampleIIR {
@@ -15,39 +25,306 @@ public:
     void Init(T source_fs, T target_fs) {
         blep_.Init(source_fs);
         blep_.SetCutoff(target_fs / 2 * TCoeff::fpass / TCoeff::fstop);
-        phase_inc_ = source_fs / target_fs;
+        if (source_fs == std::round(source_fs) && target_fs == std::round(target_fs)) {
+            // 整数的采样率, 比例是精确的
+            const auto source = static_cast<uint64_t>(source_fs);
+            const auto target = static_cast<uint64_t>(target_fs);
+            const uint64_t gcd = std::gcd(source, target);
+            phase_num_ = source / gcd;
+            phase_den_ = target / gcd;
+        }
+        else {
+            phase_den_ = kPhaseDen;
+            phase_num_ = static_cast<uint64_t>(std::llround(static_cast<double>(source_fs) / target_fs * kPhaseDen));
+        }
+        phase_scale_ = T{1} / static_cast<T>(phase_den_);
+        // 输出时刻都在输入采样上, 小数相位一直是0
+        decimation_ = phase_den_ == 1 ? static_cast<size_t>(phase_num_) : 0;
+        if (decimation_ != 0) {
+            blep_.SetDecimation(decimation_);
+            decimate_block_.assign(decimation_, T{});
+        }
+        Reset();
     }
 
-    template<std::floating_point IOSample>
-    std::vector<IOSample> Process(std::span<IOSample> x) {
-        std::vector<IOSample> ret;
+    /**
+     * @brief 低通滤波器在通带里的群延迟, 单位是输入采样
+     *        流式Process()还要再加1个输入采样, 见下面
+     */
+    T GetGroupDelay() const noexcept {
+        return blep_.GetGroupDelay();
+    }
 
+    /**
+     * @brief 清空流式Process()的状态
+     */
+    void Reset() noexcept {
         blep_.Reset();
+        stream_phase_ = 0;
+        stream_wait_ = 0;
+        stream_started_ = false;
+        decimate_filled_ = 0;
+    }
 
-        T phase{};
-        size_t rpos{};
-        blep_.Add(static_cast<T>(x[0]));
-        while (rpos < x.size() - 1) {
-            T const frac = phase;
-            T const v = blep_.Get(frac);
-            ret.push_back(static_cast<IOSample>(v));
-
-            phase += phase_inc_;
-            size_t new_rpos = rpos + static_cast<size_t>(std::floor(phase));
-            phase -= std::floor(phase);
+    /**
+     * @return 0: 一般的分数倍重采样, 否则是整数倍降采样的倍数
+     */
+    size_t GetDecimation() const noexcept {
+        return decimation_;
+    }
 
-            new_rpos = std::min(new_rpos, x.size() - 1);
-            for (size_t i = rpos; i < new_rpos; ++i) {
-                blep_.Step();
-                blep_.Add(static_cast<T>(x[i + 1]));
+    /**
+     * @brief 流式重采样, 每次输入任意长度, 滤波器状态和小数相位保留到下一次, 不分配内存
+     *        输出时刻t的采样要等到输入floor(t) + 1到了才输出(一次性的Process()也不输出最后一个输入之后的部分),
+     *        所以比滤波器多一个输入采样的延迟, 各块的输出拼起来和一次性的Process()一样
+     * @tparam Func void(IOSample)
+     */
+    template<std::floating_point IOSample, class Func>
+        requires std::invocable<Func&, IOSample>
+    void Process(std::span<const IOSample> x, Func&& on_sample) {
+        if (decimation_ != 0) {
+            ProcessDecimate(x, on_sample);
+            return;
+        }
+        for (IOSample s : x) {
+            if (!stream_started_) {
+                stream_started_ = true;
+                blep_.Add(static_cast<T>(s));
+                continue;
+            }
+            // s到了, 当前输入位置上的输出都可以算了
+            while (stream_wait_ == 0) {
+                on_sample(static_cast<IOSample>(blep_.Get(static_cast<T>(stream_phase_) * phase_scale_)));
+                stream_phase_ += phase_num_;
+                stream_wait_ = stream_phase_ / phase_den_;
+                stream_phase_ -= stream_wait_ * phase_den_;
             }
-            rpos = new_rpos;
+            blep_.Step();
+            blep_.Add(static_cast<T>(s));
+            --stream_wait_;
+        }
+    }
+
+    /**
+     * @brief 流式Process()输入num_input个采样最多输出多少个
+     */
+    size_t GetMaxOutputSize(size_t num_input) const noexcept {
+        return static_cast<size_t>(num_input * phase_den_ / phase_num_) + 1;
+    }
+
+    /**
+     * @brief 一次性重采样num_input个采样正好输出多少个: 输入最后一个采样之前的输出时刻的个数
+     */
+    size_t GetOutputSize(size_t num_input) const noexcept {
+        if (num_input == 0) return 0;
+        return static_cast<size_t>(((num_input - 1) * phase_den_ + phase_num_ - 1) / phase_num_);
+    }
+
+    /**
+     * @brief 流式重采样, 输出写进调用者的缓冲区, 和上面的Process()共用状态, 可以分块读文件或者接在音频回调后面
+     * @param out 至少GetMaxOutputSize(x.size())个
+     * @return 写了多少个
+     */
+    template<std::floating_point IOSample>
+    size_t Process(std::span<const IOSample> x, std::span<IOSample> out) {
+        assert(out.size() >= GetMaxOutputSize(x.size()));
+        return Write(x, out);
+    }
+
+    /**
+     * @brief 一次性重采样整段信号到调用者的缓冲区, 就是Reset()之后的流式Process(), 结束后流式状态也是Reset()的
+     * @param out 至少GetOutputSize(x.size())个, 可以重复使用, 不分配内存
+     * @return GetOutputSize(x.size())
+     */
+    template<std::floating_point IOSample>
+    size_t Resample(std::span<const IOSample> x, std::span<IOSample> out) {
+        assert(out.size() >= GetOutputSize(x.size()));
+        Reset();
+        const size_t num = Write(x, out);
+        Reset();
+        assert(num == GetOutputSize(x.size()));
+        return num;
+    }
+
+    /**
+     * @brief 多线程的一次性Resample(), 给几个小时的长文件用
+     *        滤波器是一组独立的一阶递推, 状态是输入的线性函数, 输入切成num_threads块:
+     *        1. 并行: 每块从0状态滤波, 写自己那一段输出, 记下结束时的状态
+     *        2. 从前往后拼接: 下一块开始前的状态 = 这一块开始前的状态 * p^块长 + 这一块从0开始的结束状态
+     *        3. 每块开头的GetSettleSamples()个输入从正确的状态重新滤波, 覆盖这段输出; 之后起始状态的影响已经衰减到浮点误差以下
+     *        总计算量和Resample()差不多; 第一块和Resample()逐位相同, 后面的块差在浮点误差内
+     * @param num_threads 0: std::thread::hardware_concurrency(), 每块至少kMinParallelChunk个输入
+     * @return GetOutputSize(x.size())
+     */
+    template<std::floating_point IOSample>
+    size_t ResampleParallel(std::span<const IOSample> x, std::span<IOSample> out, size_t num_threads = 0) {
+        assert(out.size() >= GetOutputSize(x.size()));
+        if (num_threads == 0) {
+            num_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        num_threads = std::min(num_threads, x.size() / kMinParallelChunk);
+        if (num_threads <= 1) {
+            return Resample(x, out);
+        }
+
+        // 第c块是输入[begin[c], begin[c + 1]), 整数倍降采样时对齐到StepDecimated()的M个输入
+        const size_t align = decimation_ != 0 ? decimation_ : 1;
+        const size_t chunk = (x.size() / num_threads + align - 1) / align * align;
+        std::vector<size_t> begin(num_threads + 1);
+        for (size_t c = 1; c < num_threads; ++c) {
+            begin[c] = std::min(x.size(), 1 + c * chunk);
+        }
+        begin[num_threads] = x.size();
+
+        using State = decltype(blep_.GetState());
+        std::vector<State> states(num_threads);
+        ParallelFor(num_threads, [&](size_t c) {
+            ResampleIIR worker = *this;
+            worker.blep_.Reset();
+            worker.FilterRange(x, begin[c], begin[c + 1], out);
+            states[c] = worker.blep_.GetState();
+        });
+
+        // 第c块开始前的真正状态, 只在块开头settle个输入里和0状态有可见的差别
+        const size_t settle = (GetSettleSamples() + align - 1) / align * align;
+        State carry{};
+        ResampleIIR worker = *this;
+        for (size_t c = 0; c + 1 < num_threads; ++c) {
+            carry = blep_.Combine(carry, begin[c + 1] - begin[c], states[c]);
+            worker.blep_.SetState(carry);
+            worker.FilterRange(x, begin[c + 1], std::min(begin[c + 1] + settle, begin[c + 2]), out);
         }
+        Reset();
+        return GetOutputSize(x.size());
+    }
+
+    /**
+     * @brief ResampleParallel()每块开头要重新滤波的输入个数: 最慢的极点衰减到float精度以下
+     */
+    size_t GetSettleSamples() const noexcept {
+        return blep_.GetSettleSamples(std::numeric_limits<T>::epsilon());
+    }
 
+    /**
+     * @brief 一次性重采样整段信号, 结果的长度事先算好, 只分配一次
+     */
+    template<std::floating_point IOSample>
+    std::vector<IOSample> Process(std::span<IOSample> x) {
+        std::vector<IOSample> ret(GetOutputSize(x.size()));
+        Resample(std::span<const IOSample>{x}, std::span<IOSample>{ret});
         return ret;
     }
 private:
-    T phase_inc_{};
+    // 采样率不是整数时, 相位的定点精度
+    static constexpr uint64_t kPhaseDen = uint64_t{1} << 20;
+    // ResampleParallel()每块最少的输入, 再短开线程不划算
+    static constexpr size_t kMinParallelChunk = size_t{1} << 16;
+
+    /**
+     * @brief func(0)...func(num - 1)各一个线程, func(0)在调用的线程上
+     */
+    template<class Func>
+    static void ParallelFor(size_t num, Func&& func) {
+        std::vector<std::thread> threads;
+        threads.reserve(num);
+        for (size_t c = 1; c < num; ++c) {
+            threads.emplace_back([&func, c] { func(c); });
+        }
+        if (num != 0) {
+            func(0);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    /**
+     * @brief ResampleParallel()的一块: blep_里是输入begin之前的状态, 推进到end之前, 写整数位置在[begin, end)里的输出
+     *        运算的顺序和流式Process()一样, 只是输出的下标和相位直接由输入位置算出来
+     */
+    template<std::floating_point IOSample>
+    void FilterRange(std::span<const IOSample> x, size_t begin, size_t end, std::span<IOSample> out) {
+        const uint64_t num_output = GetOutputSize(x.size());
+        // 第一个位置不小于begin的输出
+        uint64_t k = (begin * phase_den_ + phase_num_ - 1) / phase_num_;
+        if (decimation_ != 0) {
+            size_t i = begin;
+            if (i == 0) {
+                blep_.Add(static_cast<T>(x[0]));
+                if (k < num_output) out[k] = static_cast<IOSample>(blep_.Get());
+                ++k;
+                i = 1;
+            }
+            // 最后一块末尾不满M个的输入后面没有输出, 不用推进
+            for (; i + decimation_ <= end; i += decimation_) {
+                for (size_t j = 0; j < decimation_; ++j) {
+                    decimate_block_[j] = static_cast<T>(x[i + j]);
+                }
+                blep_.StepDecimated(decimate_block_.data());
+                if (k < num_output) out[k] = static_cast<IOSample>(blep_.Get());
+                ++k;
+            }
+            return;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            if (i != 0) {
+                blep_.Step();
+            }
+            blep_.Add(static_cast<T>(x[i]));
+            while (k < num_output && k * phase_num_ / phase_den_ == i) {
+                const uint64_t phase = k * phase_num_ % phase_den_;
+                out[k++] = static_cast<IOSample>(blep_.Get(static_cast<T>(phase) * phase_scale_));
+            }
+        }
+    }
+
+    template<std::floating_point IOSample>
+    size_t Write(std::span<const IOSample> x, std::span<IOSample> out) {
+        size_t num = 0;
+        Process(x, [out, &num](IOSample v) {
+            out[num++] = v;
+        });
+        return num;
+    }
+
+    /**
+     * @brief 流式Process()的整数倍降采样版本, 输出的时刻和长度都一样
+     *        第k个输出是加入了输入k * M之后的状态, 和一般的路径一样等到输入k * M + 1到了才输出
+     */
+    template<std::floating_point IOSample, class Func>
+    void ProcessDecimate(std::span<const IOSample> x, Func& on_sample) {
+        for (IOSample s : x) {
+            if (!stream_started_) {
+                stream_started_ = true;
+                blep_.Add(static_cast<T>(s));
+                stream_wait_ = 0;
+                continue;
+            }
+            if (stream_wait_ == 0) {
+                on_sample(static_cast<IOSample>(blep_.Get()));
+                stream_wait_ = 1;
+            }
+            decimate_block_[decimate_filled_++] = static_cast<T>(s);
+            if (decimate_filled_ == decimation_) {
+                blep_.StepDecimated(decimate_block_.data());
+                decimate_filled_ = 0;
+                stream_wait_ = 0;
+            }
+        }
+    }
+
+    // 每个输出前进phase_num_ / phase_den_个输入采样, 约分过
+    uint64_t phase_num_{1};
+    uint64_t phase_den_{1};
+    T phase_scale_{1};
+    // 流式Process()的状态: 下一个输出的小数相位(phase_den_分之几), 还要输入几个采样才能输出它
+    uint64_t stream_phase_{};
+    uint64_t stream_wait_{};
+    bool stream_started_{};
+    // 整数倍降采样的倍数, 0: 不是; 攒着还没推进滤波器的输入
+    size_t decimation_{};
+    std::vector<T> decimate_block_;
+    size_t decimate_filled_{};
     signalsmith::blep::EllipticBlep<TCoeff, T, kPartialStep> blep_;
 };
-}
\ No newline at end of file
+}
@@ -0,0 +1,151 @@
+// PitchShmWriter写, 几个fork出来的进程同时用PitchShmReader读, 检查没有读到写了一半的帧, 顺序不乱, 跳过的帧都计数了
+// 写到一半时写的一方重启(换成一半大小的环), 读者要发现并重新Open()
+// usage: swift_f0_shm_test [num_frames] [num_readers] [capacity]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "pitch_shm.hpp"
+
+// 每个字段都由帧序号算出来, 读到的帧和序号对不上就是读到了写了一半的帧
+static qwqdsp::pitch::PitchFrame MakeFrame(uint64_t n) {
+    qwqdsp::pitch::PitchFrame frame;
+    frame.frame = static_cast<int64_t>(n);
+    frame.sample = static_cast<int64_t>(n * 256) - 7;
+    frame.pitch = static_cast<float>(n % 100000);
+    frame.confidence = static_cast<float>(n % 1000) / 1000.0f;
+    frame.channel = static_cast<int32_t>(n % 5);
+    return frame;
+}
+
+static bool IsConsistent(const qwqdsp::pitch::PitchFrame& frame) {
+    const auto expected = MakeFrame(static_cast<uint64_t>(frame.frame));
+    return frame.sample == expected.sample && frame.pitch == expected.pitch
+        && frame.confidence == expected.confidence && frame.channel == expected.channel;
+}
+
+/**
+ * @brief 读到最后一帧为止, 写的一方中途重启时读完旧的再重新Open(), 开始得晚的读者可能直接打开新的
+ * @return 0: 正确
+ */
+static int RunReader(const std::string& name, int index, uint64_t num_frames) {
+    qwqdsp::pitch::PitchShmReader reader;
+    while (!reader.Open(name)) {
+        std::this_thread::yield();
+    }
+    qwqdsp::pitch::PitchFrame frames[64];
+    uint64_t num_read = 0;
+    uint64_t num_torn = 0;
+    uint64_t num_out_of_order = 0;
+    uint64_t num_reopen = 0;
+    int64_t last = -1;
+    // 之前Open()的环里跳过的帧
+    uint64_t lost_before = 0;
+    // 读的一方从最早没被覆盖的帧开始, 之前的帧也算跳过的
+    uint64_t skipped_on_open = 0;
+    bool first = true;
+    while (last + 1 < static_cast<int64_t>(num_frames)) {
+        const bool replaced = reader.IsReplaced();
+        const size_t num = reader.Poll(frames);
+        if (num == 0) {
+            if (replaced) {
+                // 旧的读完了
+                lost_before += reader.GetNumLost();
+                while (!reader.Open(name)) {
+                    std::this_thread::yield();
+                }
+                ++num_reopen;
+                first = true;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < num; ++i) {
+            const auto& frame = frames[i];
+            if (!IsConsistent(frame)) {
+                ++num_torn;
+                continue;
+            }
+            if (frame.frame <= last) {
+                ++num_out_of_order;
+                continue;
+            }
+            if (first) {
+                skipped_on_open += static_cast<uint64_t>(frame.frame - last - 1) - reader.GetNumLost();
+                first = false;
+            }
+            last = frame.frame;
+            ++num_read;
+        }
+        // 慢一点的读者, 测试跟不上时的跳过
+        if (index == 0) {
+            std::this_thread::yield();
+        }
+    }
+    const uint64_t num_lost = lost_before + reader.GetNumLost();
+    const uint64_t accounted = skipped_on_open + num_read + num_lost;
+    const bool ok = num_torn == 0 && num_out_of_order == 0 && accounted == num_frames && num_reopen <= 1;
+    std::printf("reader %d: read=%llu lost=%llu skipped_on_open=%llu torn=%llu out_of_order=%llu reopen=%llu %s\n",
+        index, static_cast<unsigned long long>(num_read), static_cast<unsigned long long>(num_lost),
+        static_cast<unsigned long long>(skipped_on_open), static_cast<unsigned long long>(num_torn),
+        static_cast<unsigned long long>(num_out_of_order), static_cast<unsigned long long>(num_reopen),
+        ok ? "ok" : "FAILED");
+    // 子进程用_Exit()退出, 不会自己flush
+    std::fflush(stdout);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char const *argv[]) {
+    const uint64_t num_frames = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const int num_readers = argc > 2 ? std::atoi(argv[2]) : 3;
+    const size_t capacity = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1024;
+    const std::string name = "/swift_f0_shm_test_" + std::to_string(getpid());
+
+    qwqdsp::pitch::PitchShmWriter writer;
+    if (!writer.Open(name, capacity, 16000.0f)) {
+        std::printf("can not open %s\n", name.c_str());
+        return 1;
+    }
+    std::vector<pid_t> readers;
+    for (int i = 0; i < num_readers; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::_Exit(RunReader(name, i, num_frames));
+        }
+        readers.push_back(pid);
+    }
+
+    for (uint64_t n = 0; n < num_frames; ++n) {
+        // 写到一半重启, 换成更小的环, 读者还映射着旧的
+        if (n == num_frames / 2) {
+            writer.Close();
+            if (!writer.Open(name, std::max<size_t>(capacity / 2, 1), 16000.0f)) {
+                std::printf("can not reopen %s\n", name.c_str());
+                return 1;
+            }
+        }
+        writer.Write(MakeFrame(n));
+        // 单核的机器上也让读的进程在写的中途运行
+        if (n % 256 == 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    int failed = 0;
+    for (pid_t pid : readers) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ++failed;
+        }
+    }
+    writer.Close();
+    shm_unlink(name.c_str());
+    std::printf("%llu frames, %d readers, capacity %zu: %s\n", static_cast<unsigned long long>(num_frames),
+        num_readers, capacity, failed == 0 ? "ok" : "FAILED");
+    return failed == 0 ? 0 : 1;
+}
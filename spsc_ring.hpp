@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace qwqdsp::segement {
+/**
+ * @brief 单生产者单消费者的无锁环形缓冲, 两边都不会阻塞, 可以在音频回调里写
+ *        读写位置是一直增加的size_t, 容量是2的幂, 用掩码取下标
+ *        满了以后生产者丢弃新的数据并计数, 不覆盖消费者还没读的部分
+ */
+template<class T>
+class SpscRing {
+public:
+    /**
+     * @brief 不是线程安全的, 在两边开始读写之前调用
+     * @param min_capacity 向上取到2的幂
+     */
+    void Init(size_t min_capacity) {
+        buffer_.assign(std::bit_ceil(std::max<size_t>(min_capacity, 1)), T{});
+        mask_ = buffer_.size() - 1;
+        Reset();
+    }
+
+    void Reset() noexcept {
+        write_pos_.store(0, std::memory_order_relaxed);
+        read_pos_.store(0, std::memory_order_relaxed);
+        num_overruns_.store(0, std::memory_order_relaxed);
+        num_dropped_.store(0, std::memory_order_relaxed);
+    }
+
+    size_t GetCapacity() const noexcept {
+        return buffer_.size();
+    }
+
+    // -------------------- 生产者 --------------------
+
+    /**
+     * @brief 写入能放下的部分, 放不下的丢弃, 计一次overrun
+     * @return 写入的个数
+     */
+    size_t Push(std::span<const T> x) noexcept {
+        const size_t write = write_pos_.load(std::memory_order_relaxed);
+        const size_t read = read_pos_.load(std::memory_order_acquire);
+        const size_t num = std::min(x.size(), buffer_.size() - (write - read));
+        if (num != x.size()) {
+            num_overruns_.store(num_overruns_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            num_dropped_.store(num_dropped_.load(std::memory_order_relaxed) + x.size() - num, std::memory_order_relaxed);
+        }
+        Copy(x.data(), num, write);
+        write_pos_.store(write + num, std::memory_order_release);
+        return num;
+    }
+
+    // -------------------- 消费者 --------------------
+
+    size_t GetNumReadable() const noexcept {
+        return write_pos_.load(std::memory_order_acquire) - read_pos_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 凑齐out.size()个才读, 用来一次取一个hop
+     * @return false: 不够, 什么也没读
+     */
+    bool Pop(std::span<T> out) noexcept {
+        const size_t read = read_pos_.load(std::memory_order_relaxed);
+        const size_t write = write_pos_.load(std::memory_order_acquire);
+        if (write - read < out.size()) return false;
+        CopyOut(out.data(), out.size(), read);
+        read_pos_.store(read + out.size(), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 生产者因为缓冲满了丢数据的次数, 任何线程都可以读
+     */
+    size_t GetNumOverruns() const noexcept {
+        return num_overruns_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 一共丢掉的元素个数
+     */
+    size_t GetNumDropped() const noexcept {
+        return num_dropped_.load(std::memory_order_relaxed);
+    }
+private:
+    void Copy(const T* src, size_t num, size_t pos) noexcept {
+        const size_t begin = pos & mask_;
+        const size_t first = std::min(num, buffer_.size() - begin);
+        std::copy_n(src, first, buffer_.data() + begin);
+        std::copy_n(src + first, num - first, buffer_.data());
+    }
+
+    void CopyOut(T* dst, size_t num, size_t pos) const noexcept {
+        const size_t begin = pos & mask_;
+        const size_t first = std::min(num, buffer_.size() - begin);
+        std::copy_n(buffer_.data() + begin, first, dst);
+        std::copy_n(buffer_.data(), num - first, dst + first);
+    }
+
+    std::vector<T> buffer_;
+    size_t mask_{};
+    // 两个位置分别只被一边写, 放在不同的cache line上
+    alignas(64) std::atomic<size_t> write_pos_{};
+    std::atomic<size_t> num_overruns_{};
+    std::atomic<size_t> num_dropped_{};
+    alignas(64) std::atomic<size_t> read_pos_{};
+};
+}
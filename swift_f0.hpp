@@ -0,0 +1,389 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include <onnxruntime_cxx_api.h>
+#include <onnxruntime_session_options_config_keys.h>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "onnx_proto.hpp"
+#include "swift_f0_session_config.hpp"
+
+namespace qwqdsp::pitch {
+/**
+ * @brief SwiftF0推理会话
+ *        输入输出名字只解析一次, 输入输出缓冲区通过IoBinding预先绑定, Process()不再分配内存
+ */
+class PitchDetector {
+public:
+    // 模型内部的stft参数
+    static constexpr size_t kFFTSize = 1024;
+    static constexpr size_t kHopSize = 256;
+    // 模型在音频两端各补384个0
+    static constexpr size_t kPadSize = 384;
+    // 送进卷积的频点数, stft的第3...134个bin
+    static constexpr size_t kNumFreqs = 132;
+    // Softmax输出的音高bin数
+    static constexpr size_t kNumPitchBins = 200;
+
+    enum class InputType {
+        // 音频{batch, num_samples}
+        kAudio,
+        // SwiftF0FrontEnd算好的log|STFT| {batch, time_frames, kNumFreqs}, 跳过模型里的STFT
+        kLogMagnitude
+    };
+
+    static constexpr size_t NumFrames(size_t num_samples) noexcept {
+        if (num_samples + 2 * kPadSize < kFFTSize) return 0;
+        return (num_samples + 2 * kPadSize - kFFTSize) / kHopSize + 1;
+    }
+
+    /**
+     * @param num_samples 每次Process()每一路输入的采样数, InputType::kLogMagnitude时是帧数
+     * @param batch_size 每次Process()的路数, 导出的模型batch固定是1, 加载时改成动态的
+     * @param output_probabilities 同时输出Softmax, GetProbabilities()
+     */
+    void Init(const ORTCHAR_T* model_path, size_t num_samples, size_t batch_size = 1,
+              const Ort::SessionOptions& session_options = Ort::SessionOptions{},
+              InputType input_type = InputType::kAudio, bool output_probabilities = false) {
+        input_type_ = input_type;
+        std::string model = LoadModel(model_path, input_type, output_probabilities);
+        binding_ = Ort::IoBinding{nullptr};
+        session_ = Ort::Session{GetEnv(), model.data(), model.size(), session_options};
+        OnSessionCreated(num_samples, batch_size);
+    }
+
+    /**
+     * @brief config.model_cache时, 第一次运行把优化后的graph以ORT格式保存在模型旁边, 之后直接加载它
+     *        缓存的文件名里有模型内容的hash, onnxruntime版本和优化等级, 任何一个变了都会重新生成
+     *        ORT_ENABLE_ALL的NCHWc layout和CPU有关(块大小取决于AVX2/AVX-512), 加载ORT格式时不会重新做,
+     *        所以这时文件名里还有CPU指令集的指纹, 模型目录在共享存储或者容器镜像里时, 别的机器会生成自己的缓存
+     */
+    void Init(const ORTCHAR_T* model_path, size_t num_samples, size_t batch_size, const SessionConfig& config,
+              InputType input_type = InputType::kAudio, bool output_probabilities = false) {
+        input_type_ = input_type;
+        std::string model = LoadModel(model_path, input_type, output_probabilities);
+        binding_ = Ort::IoBinding{nullptr};
+        if (config.model_cache) {
+            CreateCachedSession(model_path, model, config);
+        }
+        else {
+            session_ = Ort::Session{GetEnv(), model.data(), model.size(), config.MakeSessionOptions()};
+        }
+        OnSessionCreated(num_samples, batch_size);
+    }
+
+    /**
+     * @brief 优化后的模型缓存的位置
+     */
+    static std::filesystem::path GetModelCachePath(const std::filesystem::path& model_path, std::string_view model,
+                                                   const SessionConfig& config) {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : model) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        char hash_str[17];
+        std::snprintf(hash_str, sizeof(hash_str), "%016llx", static_cast<unsigned long long>(hash));
+        std::string name = model_path.stem().string() + "." + hash_str
+            + ".ort" + Ort::GetVersionString()
+            + ".opt" + std::to_string(static_cast<int>(config.graph_optimization_level));
+        if (config.graph_optimization_level > GraphOptimizationLevel::ORT_ENABLE_EXTENDED) {
+            name += ".cpu" + GetCpuFingerprint();
+        }
+        name += ".ort";
+        return model_path.parent_path() / name;
+    }
+
+    /**
+     * @brief 改变每次输入的形状{batch_size, num_samples}, 重新分配并绑定缓冲区
+     *        InputType::kLogMagnitude时num_samples是帧数, 形状是{batch_size, num_samples, kNumFreqs}
+     */
+    void Resize(size_t num_samples, size_t batch_size = 1) {
+        const bool log_magnitude = input_type_ == InputType::kLogMagnitude;
+        num_samples_ = num_samples;
+        num_frames_ = log_magnitude ? num_samples : NumFrames(num_samples);
+        batch_size_ = batch_size;
+        input_.assign(batch_size_ * num_samples_ * (log_magnitude ? kNumFreqs : 1), 0.0f);
+        pitch_.assign(batch_size_ * num_frames_, 0.0f);
+        confidence_.assign(batch_size_ * num_frames_, 0.0f);
+        probabilities_.assign(probabilities_name_.empty() ? 0 : batch_size_ * num_frames_ * kNumPitchBins, 0.0f);
+
+        Ort::MemoryInfo memory_info = Ort::MemoryInfo::CreateCpu(
+            OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
+        int64_t input_shape[]{static_cast<int64_t>(batch_size_), static_cast<int64_t>(num_samples_),
+                              static_cast<int64_t>(kNumFreqs)};
+        int64_t output_shape[]{static_cast<int64_t>(batch_size_), static_cast<int64_t>(num_frames_)};
+        input_tensor_ = Ort::Value::CreateTensor<float>(
+            memory_info, input_.data(), input_.size(), input_shape, log_magnitude ? 3 : 2);
+        pitch_tensor_ = Ort::Value::CreateTensor<float>(
+            memory_info, pitch_.data(), pitch_.size(), output_shape, 2);
+        confidence_tensor_ = Ort::Value::CreateTensor<float>(
+            memory_info, confidence_.data(), confidence_.size(), output_shape, 2);
+
+        binding_ = Ort::IoBinding{session_};
+        binding_.BindInput(input_name_.c_str(), input_tensor_);
+        binding_.BindOutput(pitch_name_.c_str(), pitch_tensor_);
+        binding_.BindOutput(confidence_name_.c_str(), confidence_tensor_);
+        if (!probabilities_name_.empty()) {
+            int64_t probabilities_shape[]{static_cast<int64_t>(batch_size_), static_cast<int64_t>(num_frames_),
+                                          static_cast<int64_t>(kNumPitchBins)};
+            probabilities_tensor_ = Ort::Value::CreateTensor<float>(
+                memory_info, probabilities_.data(), probabilities_.size(), probabilities_shape, 3);
+            binding_.BindOutput(probabilities_name_.c_str(), probabilities_tensor_);
+        }
+    }
+
+    /**
+     * @brief 写入音频的地方, [batch_size][num_samples], Process()会直接读取它
+     *        InputType::kLogMagnitude时是[batch_size][time_frames][kNumFreqs]
+     */
+    std::span<float> GetInput() noexcept {
+        return input_;
+    }
+
+    void Process() {
+        session_.Run(run_options_, binding_);
+    }
+
+    /**
+     * @brief 和NativePitchDetector::Process一样的接口, 形状不同时会Resize()
+     * @param x [batch_size][x.size() / batch_size], batch_size为0或者x.size()不能整除时抛出ORT_INVALID_ARGUMENT
+     */
+    void Process(std::span<const float> x, size_t batch_size = 1) {
+        if (input_type_ != InputType::kAudio) {
+            throw Ort::Exception{"session expects log magnitude input", ORT_INVALID_ARGUMENT};
+        }
+        if (batch_size == 0 || x.size() % batch_size != 0) {
+            throw Ort::Exception{"input size is not a multiple of batch_size", ORT_INVALID_ARGUMENT};
+        }
+        if (batch_size != batch_size_ || x.size() != batch_size_ * num_samples_) {
+            Resize(x.size() / batch_size, batch_size);
+        }
+        std::copy(x.begin(), x.end(), input_.begin());
+        Process();
+    }
+
+    /**
+     * @brief 和NativePitchDetector::ProcessLogMagnitude一样的接口, 需要InputType::kLogMagnitude
+     * @param x [batch_size][time_frames][kNumFreqs], x.size()不是batch_size * kNumFreqs的倍数时抛出ORT_INVALID_ARGUMENT
+     */
+    void ProcessLogMagnitude(std::span<const float> x, size_t batch_size = 1) {
+        if (input_type_ != InputType::kLogMagnitude) {
+            throw Ort::Exception{"session expects audio input", ORT_INVALID_ARGUMENT};
+        }
+        if (batch_size == 0 || x.size() % (batch_size * kNumFreqs) != 0) {
+            throw Ort::Exception{"input size is not a multiple of batch_size * kNumFreqs", ORT_INVALID_ARGUMENT};
+        }
+        if (batch_size != batch_size_ || x.size() != input_.size()) {
+            Resize(x.size() / batch_size / kNumFreqs, batch_size);
+        }
+        std::copy(x.begin(), x.end(), input_.begin());
+        Process();
+    }
+
+    /**
+     * @return [batch_size][GetNumFrames()]
+     */
+    std::span<const float> GetPitch() const noexcept {
+        return pitch_;
+    }
+
+    std::span<const float> GetConfidence() const noexcept {
+        return confidence_;
+    }
+
+    /**
+     * @return Softmax, [batch_size][GetNumFrames()][kNumPitchBins], Init()时output_probabilities才有
+     */
+    std::span<const float> GetProbabilities() const noexcept {
+        return probabilities_;
+    }
+
+    size_t GetNumSamples() const noexcept {
+        return num_samples_;
+    }
+
+    /**
+     * @brief 每一路输出的帧数
+     */
+    size_t GetNumFrames() const noexcept {
+        return num_frames_;
+    }
+
+    size_t GetBatchSize() const noexcept {
+        return batch_size_;
+    }
+
+    InputType GetInputType() const noexcept {
+        return input_type_;
+    }
+
+    static Ort::Env& GetEnv() {
+        static Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "SwiftF0");
+        return env;
+    }
+private:
+    static std::string LoadModel(const ORTCHAR_T* model_path, InputType input_type, bool output_probabilities) {
+        std::string model;
+        if (!onnx::ReadFile(std::filesystem::path{model_path}, model)) {
+            throw Ort::Exception{"can not open model", ORT_NO_SUCHFILE};
+        }
+        model = onnx::MakeBatchDynamic(model);
+        if (input_type == InputType::kLogMagnitude) {
+            model = onnx::MakeLogMagnitudeInput(model, kNumFreqs);
+            if (model.empty()) {
+                throw Ort::Exception{"model has no Log node to split at", ORT_INVALID_GRAPH};
+            }
+        }
+        if (output_probabilities) {
+            std::string name;
+            model = onnx::AddSoftmaxOutput(model, name);
+            if (model.empty()) {
+                throw Ort::Exception{"model has no Softmax node", ORT_INVALID_GRAPH};
+            }
+        }
+        return model;
+    }
+
+    void OnSessionCreated(size_t num_samples, size_t batch_size) {
+        Ort::AllocatorWithDefaultOptions allocator;
+        input_name_ = session_.GetInputNameAllocated(0, allocator).get();
+        pitch_name_ = session_.GetOutputNameAllocated(0, allocator).get();
+        confidence_name_ = session_.GetOutputNameAllocated(1, allocator).get();
+        probabilities_name_.clear();
+        if (session_.GetOutputCount() > 2) {
+            probabilities_name_ = session_.GetOutputNameAllocated(2, allocator).get();
+        }
+
+        Resize(num_samples, batch_size);
+    }
+
+    /**
+     * @brief CPU指令集的指纹, x86是cpuid的特性位和操作系统打开的寄存器状态(XCR0)的hash, 其他架构只有架构名
+     */
+    static std::string GetCpuFingerprint() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        // leaf 1: ecx, edx; leaf 7: ebx, ecx, edx; XCR0
+        uint32_t words[6]{};
+        uint32_t regs[4]{};
+        auto cpuid = [&regs](uint32_t leaf) {
+#if defined(_M_X64) || defined(_M_IX86)
+            int r[4];
+            __cpuidex(r, static_cast<int>(leaf), 0);
+            for (size_t i = 0; i < 4; ++i) regs[i] = static_cast<uint32_t>(r[i]);
+#else
+            __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        };
+        cpuid(0);
+        const uint32_t max_leaf = regs[0];
+        cpuid(1);
+        words[0] = regs[2];
+        words[1] = regs[3];
+        if (max_leaf >= 7) {
+            cpuid(7);
+            words[2] = regs[1];
+            words[3] = regs[2];
+            words[4] = regs[3];
+        }
+        // OSXSAVE
+        if (words[0] & (1u << 27)) {
+#if defined(_M_X64) || defined(_M_IX86)
+            words[5] = static_cast<uint32_t>(_xgetbv(0));
+#else
+            uint32_t eax{}, edx{};
+            __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            words[5] = eax;
+#endif
+        }
+        // leaf 1的eax/ebx是型号和APIC id, 同样的指令集也会不同, 不算在内
+        uint64_t hash = 14695981039346656037ull;
+        for (uint32_t word : words) {
+            for (size_t i = 0; i < 4; ++i) {
+                hash ^= (word >> (8 * i)) & 0xff;
+                hash *= 1099511628211ull;
+            }
+        }
+        char str[17];
+        std::snprintf(str, sizeof(str), "%016llx", static_cast<unsigned long long>(hash));
+        return str;
+#elif defined(_M_ARM64) || defined(__aarch64__)
+        return "arm64";
+#else
+        return "generic";
+#endif
+    }
+
+    void CreateCachedSession(const ORTCHAR_T* model_path, std::string_view model, const SessionConfig& config) {
+        const auto cache_path = GetModelCachePath(model_path, model, config);
+        std::error_code ec;
+        if (std::filesystem::exists(cache_path, ec)) {
+            try {
+                Ort::SessionOptions options = config.MakeSessionOptions();
+                options.AddConfigEntry(kOrtSessionOptionsConfigLoadModelFormat, "ORT");
+                session_ = Ort::Session{GetEnv(), cache_path.c_str(), options};
+                return;
+            }
+            catch (const Ort::Exception&) {
+                // 损坏的缓存, 重新生成
+                std::filesystem::remove(cache_path, ec);
+            }
+        }
+
+        // 多个进程可能同时生成, 各自写临时文件再改名, 读到的总是完整的文件
+        auto temp_path = cache_path;
+        temp_path += "." + std::to_string(std::random_device{}()) + ".tmp";
+        try {
+            Ort::SessionOptions options = config.MakeSessionOptions();
+            options.SetOptimizedModelFilePath(temp_path.c_str());
+            options.AddConfigEntry(kOrtSessionOptionsConfigSaveModelFormat, "ORT");
+            session_ = Ort::Session{GetEnv(), model.data(), model.size(), options};
+        }
+        catch (const Ort::Exception&) {
+            // 比如模型所在的目录不可写, 不使用缓存
+            std::filesystem::remove(temp_path, ec);
+            session_ = Ort::Session{GetEnv(), model.data(), model.size(), config.MakeSessionOptions()};
+            return;
+        }
+        std::filesystem::rename(temp_path, cache_path, ec);
+        if (ec) {
+            std::filesystem::remove(temp_path, ec);
+        }
+    }
+
+    Ort::Session session_{nullptr};
+    Ort::IoBinding binding_{nullptr};
+    Ort::RunOptions run_options_;
+    Ort::Value input_tensor_{nullptr};
+    Ort::Value pitch_tensor_{nullptr};
+    Ort::Value confidence_tensor_{nullptr};
+    Ort::Value probabilities_tensor_{nullptr};
+
+    std::string input_name_;
+    std::string pitch_name_;
+    std::string confidence_name_;
+    std::string probabilities_name_;
+
+    InputType input_type_{InputType::kAudio};
+    size_t num_samples_{};
+    size_t num_frames_{};
+    size_t batch_size_{1};
+    std::vector<float> input_;
+    std::vector<float> pitch_;
+    std::vector<float> confidence_;
+    std::vector<float> probabilities_;
+};
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <filesystem>
+#include <utility>
+#include <vector>
+#include "AudioFile.h"
+#include "resample_iir.hpp"
+#include "resample_coeffs.h"
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 读取wav的第一个声道, 不是16kHz的重采样到16kHz(模型的输入采样率)
+ * @param log_errors false时读取失败不打印AudioFile的错误, 由调用者自己报告
+ * @return 读取失败返回false, out不变
+ */
+inline bool LoadAudio16k(const std::filesystem::path& path, std::vector<float>& out, bool log_errors = true) {
+    AudioFile<float> infile;
+    infile.shouldLogErrorsToConsole(log_errors);
+    if (!infile.load(path.string())) {
+        return false;
+    }
+    if (infile.getSampleRate() != 16000) {
+        qwqdsp::fx::ResampleIIR<qwqdsp::fx::coeff::MedianCoeffs<float>, 127> resampler;
+        resampler.Init(infile.getSampleRate(), 16000);
+        out = resampler.Process<float>(infile.samples.front());
+    }
+    else {
+        out = std::move(infile.samples.front());
+    }
+    return true;
+}
+}
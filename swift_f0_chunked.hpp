@@ -0,0 +1,232 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 把长音频切成重叠的窗口分别推理再拼起来, 推理的内存只和窗口大小有关
+ *        窗口从hop的整数倍开始, 所以窗口内的帧和整段推理的帧对齐
+ *        窗口边缘被0 padding影响的帧丢掉, 由相邻窗口的中间部分提供, 拼接结果和整段推理一致
+ *        除了碰到文件结尾的窗口, 所有窗口一样长, 每batch_size个叠成{batch_size, window}一起推理
+ *        ProcessLogMagnitude()输入SwiftF0FrontEnd算好的log|STFT|, 没有stft的padding, 窗口只需要卷积的context
+ *        BeginLogMagnitude()/PushLogMagnitude()是它的流式版本, 不需要整段的log|STFT|
+ * @tparam Detector PitchDetector或NativePitchDetector, 需要Process(std::span<const float>, size_t batch_size), GetPitch(), GetConfidence()
+ *         使用ProcessLogMagnitude()时还需要ProcessLogMagnitude(std::span<const float>, size_t batch_size)
+ */
+template<class Detector>
+class ChunkedPitchDetector {
+public:
+    static constexpr size_t kFFTSize = 1024;
+    static constexpr size_t kHopSize = 256;
+    static constexpr size_t kPadSize = 384;
+    static constexpr size_t kNumFreqs = 132;
+    // 5层5x5卷积每层向内扩散2帧
+    static constexpr size_t kConvContextFrames = 5 * 2;
+    // 窗口两端的padding还会改变ceil(kPadSize/kHopSize)=2帧stft
+    static constexpr size_t kContextFrames = (kPadSize + kHopSize - 1) / kHopSize + kConvContextFrames;
+
+    static constexpr size_t NumFrames(size_t num_samples) noexcept {
+        if (num_samples + 2 * kPadSize < kFFTSize) return 0;
+        return (num_samples + 2 * kPadSize - kFFTSize) / kHopSize + 1;
+    }
+
+    /**
+     * @param chunk_frames 每个窗口输出多少帧, 窗口还会在两边多带kContextFrames帧
+     * @param batch_size 一次推理多少个窗口
+     */
+    void Init(size_t chunk_frames, size_t batch_size = 1) noexcept {
+        chunk_frames_ = std::max<size_t>(chunk_frames, 1);
+        batch_size_ = std::max<size_t>(batch_size, 1);
+    }
+
+    Detector& GetDetector() noexcept {
+        return detector_;
+    }
+
+    size_t GetBatchSize() const noexcept {
+        return batch_size_;
+    }
+
+    /**
+     * @brief 窗口的采样数
+     */
+    size_t GetWindowSize() const noexcept {
+        return (chunk_frames_ + 2 * kContextFrames) * kHopSize;
+    }
+
+    /**
+     * @brief ProcessLogMagnitude()窗口的帧数
+     */
+    size_t GetWindowFrames() const noexcept {
+        return chunk_frames_ + 2 * kConvContextFrames;
+    }
+
+    void Process(std::span<const float> x) {
+        ProcessChunks<false>(x, NumFrames(x.size()), kContextFrames, kHopSize, GetWindowSize());
+    }
+
+    /**
+     * @param x [time_frames][kNumFreqs]
+     */
+    void ProcessLogMagnitude(std::span<const float> x) {
+        ProcessChunks<true>(x, x.size() / kNumFreqs, kConvContextFrames, kNumFreqs, GetWindowFrames() * kNumFreqs);
+    }
+
+    /**
+     * @brief 流式的ProcessLogMagnitude(): 总帧数事先知道(SwiftF0FrontEnd::NumFrames()), 之后帧一块一块地PushLogMagnitude()
+     *        只缓存还没推理的窗口, 内存和文件长度无关(除了每帧的pitch和confidence), 结果和ProcessLogMagnitude()一样
+     */
+    void BeginLogMagnitude(size_t num_frames) {
+        Begin(num_frames, GetWindowFrames() * kNumFreqs);
+        stream_frames_.clear();
+        stream_first_frame_ = 0;
+        stream_next_chunk_ = 0;
+        if (num_frames == 0) {
+            Flush<true>();
+        }
+    }
+
+    /**
+     * @param frames [n][kNumFreqs], 接着上一次的帧, 一共BeginLogMagnitude()的num_frames帧, 最后一块推完结果就全了
+     */
+    void PushLogMagnitude(std::span<const float> frames) {
+        const size_t window_size = GetWindowFrames() * kNumFreqs;
+        stream_frames_.insert(stream_frames_.end(), frames.begin(), frames.end());
+        const size_t num_frames = pitch_.size();
+        const size_t available = stream_first_frame_ + stream_frames_.size() / kNumFreqs;
+        while (stream_next_chunk_ < num_frames) {
+            const Chunk chunk = MakeChunk(stream_next_chunk_, num_frames, kConvContextFrames);
+            // 完整的窗口, 或者到文件结尾的窗口
+            const size_t window_end = std::min(chunk.window_frame + GetWindowFrames(), num_frames);
+            if (window_end > available) {
+                return;
+            }
+            const size_t offset = (chunk.window_frame - stream_first_frame_) * kNumFreqs;
+            AddChunk<true>(chunk, std::span<const float>{stream_frames_}.subspan(offset), window_size);
+            stream_next_chunk_ = chunk.end;
+            // 下一个窗口之前的帧不再需要
+            if (stream_next_chunk_ < num_frames) {
+                const size_t next_window = MakeChunk(stream_next_chunk_, num_frames, kConvContextFrames).window_frame;
+                stream_frames_.erase(stream_frames_.begin(),
+                                     stream_frames_.begin() + (next_window - stream_first_frame_) * kNumFreqs);
+                stream_first_frame_ = next_window;
+            }
+        }
+        Flush<true>();
+        stream_frames_.clear();
+    }
+
+    std::span<const float> GetPitch() const noexcept {
+        return pitch_;
+    }
+
+    std::span<const float> GetConfidence() const noexcept {
+        return confidence_;
+    }
+
+    size_t GetNumFrames() const noexcept {
+        return pitch_.size();
+    }
+private:
+    struct Chunk {
+        size_t begin;
+        size_t end;
+        size_t window_frame;
+    };
+
+    void Begin(size_t num_frames, size_t window_size) {
+        pitch_.resize(num_frames);
+        confidence_.resize(num_frames);
+        batch_input_.resize(batch_size_ * window_size);
+        batch_chunks_.resize(batch_size_);
+        num_batched_ = 0;
+    }
+
+    Chunk MakeChunk(size_t begin, size_t num_frames, size_t context_frames) const noexcept {
+        Chunk chunk;
+        chunk.begin = begin;
+        chunk.end = std::min(begin + chunk_frames_, num_frames);
+        // 从文件开头开始的窗口, 那一端的padding和整段推理一样, 不需要context
+        chunk.window_frame = begin > context_frames ? begin - context_frames : 0;
+        return chunk;
+    }
+
+    /**
+     * @param window 从窗口开头到x的结尾
+     * @param window_size 窗口在x里有多少个数
+     */
+    template<bool kLogMagnitude>
+    void AddChunk(const Chunk& chunk, std::span<const float> window, size_t window_size) {
+        if (window_size <= window.size()) {
+            std::copy_n(window.begin(), window_size, batch_input_.begin() + num_batched_ * window_size);
+            batch_chunks_[num_batched_++] = chunk;
+            if (num_batched_ == batch_size_) {
+                Flush<kLogMagnitude>();
+            }
+        }
+        else {
+            // 到文件结尾的窗口, 结尾的padding和整段推理一样, 单独推理
+            Run<kLogMagnitude>(window, 1);
+            Collect(chunk, 0);
+        }
+    }
+
+    /**
+     * @param frame_stride 相邻两帧在x里相差多少个数
+     * @param window_size 窗口在x里有多少个数
+     */
+    template<bool kLogMagnitude>
+    void ProcessChunks(std::span<const float> x, size_t num_frames, size_t context_frames,
+                       size_t frame_stride, size_t window_size) {
+        Begin(num_frames, window_size);
+        for (size_t begin = 0; begin < num_frames; begin += chunk_frames_) {
+            const Chunk chunk = MakeChunk(begin, num_frames, context_frames);
+            AddChunk<kLogMagnitude>(chunk, x.subspan(chunk.window_frame * frame_stride), window_size);
+        }
+        Flush<kLogMagnitude>();
+    }
+
+    template<bool kLogMagnitude>
+    void Run(std::span<const float> x, size_t batch_size) {
+        if constexpr (kLogMagnitude) {
+            detector_.ProcessLogMagnitude(x, batch_size);
+        }
+        else {
+            detector_.Process(x, batch_size);
+        }
+    }
+
+    template<bool kLogMagnitude>
+    void Flush() {
+        if (num_batched_ == 0) return;
+        const size_t input_size = batch_input_.size() / batch_size_ * num_batched_;
+        Run<kLogMagnitude>(std::span<const float>{batch_input_.data(), input_size}, num_batched_);
+        for (size_t b = 0; b < num_batched_; ++b) {
+            Collect(batch_chunks_[b], b);
+        }
+        num_batched_ = 0;
+    }
+
+    void Collect(const Chunk& chunk, size_t batch_idx) {
+        const size_t first = batch_idx * detector_.GetNumFrames() + chunk.begin - chunk.window_frame;
+        const size_t count = chunk.end - chunk.begin;
+        std::copy_n(detector_.GetPitch().begin() + first, count, pitch_.begin() + chunk.begin);
+        std::copy_n(detector_.GetConfidence().begin() + first, count, confidence_.begin() + chunk.begin);
+    }
+
+    Detector detector_;
+    size_t chunk_frames_{2048};
+    size_t batch_size_{1};
+    std::vector<float> batch_input_;
+    std::vector<Chunk> batch_chunks_;
+    size_t num_batched_{};
+    // PushLogMagnitude(): 从stream_first_frame_开始还需要的帧, 下一个块的第一帧
+    std::vector<float> stream_frames_;
+    size_t stream_first_frame_{};
+    size_t stream_next_chunk_{};
+    std::vector<float> pitch_;
+    std::vector<float> confidence_;
+};
+}
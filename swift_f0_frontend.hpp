@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <vector>
+#include "oouras_real_fft.hpp"
+#include "swift_f0_weights.hpp"
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 模型里Pad -> STFT -> |X| -> Slice -> Log的C++实现
+ *        输出{time_frames, kNumFreqs}的log|STFT|, 可以直接送进PitchDetector(InputType::kLogMagnitude)
+ *        或者NativePitchDetector::ProcessLogMagnitude, 每一帧的完整频谱可以用GetSpectrum()拿去显示
+ *        这样同一帧音频只做一次FFT
+ */
+class SwiftF0FrontEnd {
+public:
+    using Weights = SwiftF0Weights;
+    static constexpr size_t kFFTSize = Weights::kFFTSize;
+    static constexpr size_t kHopSize = Weights::kHopSize;
+    static constexpr size_t kPadSize = Weights::kPadSize;
+    static constexpr size_t kNumFreqs = Weights::kNumFreqs;
+
+    static constexpr size_t NumFrames(size_t num_samples) noexcept {
+        if (num_samples + 2 * kPadSize < kFFTSize) return 0;
+        return (num_samples + 2 * kPadSize - kFFTSize) / kHopSize + 1;
+    }
+
+    bool Init(const std::filesystem::path& model_path) {
+        Weights weights;
+        if (!weights.Load(model_path)) return false;
+        Init(weights.window);
+        return true;
+    }
+
+    /**
+     * @param window 模型STFT的窗, kFFTSize个
+     */
+    void Init(std::span<const float> window) {
+        fft_.Init(kFFTSize);
+        window_.assign(window.begin(), window.end());
+        windowed_.resize(kFFTSize);
+        spectrum_.resize(kFFTSize + 2);
+    }
+
+    std::span<const float> GetWindow() const noexcept {
+        return window_;
+    }
+
+    /**
+     * @brief 一帧
+     * @param frame kFFTSize个采样
+     * @param column kNumFreqs个log|X|
+     */
+    void ProcessFrame(const float* frame, float* column) noexcept {
+        for (size_t i = 0; i < kFFTSize; ++i) {
+            windowed_[i] = frame[i] * window_[i];
+        }
+        fft_.FFT(windowed_.data(), spectrum_.data());
+        for (size_t i = 0; i < kNumFreqs; ++i) {
+            float re = spectrum_[2 * (i + Weights::kMinBin)];
+            float im = spectrum_[2 * (i + Weights::kMinBin) + 1];
+            column[i] = std::log(std::sqrt(re * re + im * im) + Weights::kLogEpsilon);
+        }
+    }
+
+    /**
+     * @brief 和模型一样在两端补kPadSize个0, 计算整段音频
+     * @param out NumFrames(x.size()) * kNumFreqs个
+     * @tparam Func void(size_t frame, std::span<const float> spectrum), 每算完一帧调用一次
+     */
+    template<class Func>
+    void Process(std::span<const float> x, std::span<float> out, Func&& on_frame) {
+        Process(x, 0, out.subspan(0, NumFrames(x.size()) * kNumFreqs), on_frame);
+    }
+
+    /**
+     * @brief 只算从first_frame开始的out.size() / kNumFreqs帧, 分块送进ChunkedPitchDetector::PushLogMagnitude(),
+     *        不需要整段音频的输出
+     * @tparam Func void(size_t frame, std::span<const float> spectrum), frame是整段音频里的帧号
+     */
+    template<class Func>
+    void Process(std::span<const float> x, size_t first_frame, std::span<float> out, Func&& on_frame) {
+        const size_t num_frames = out.size() / kNumFreqs;
+        frame_.resize(kFFTSize);
+        for (size_t f = 0; f < num_frames; ++f) {
+            const size_t t = first_frame + f;
+            for (size_t i = 0; i < kFFTSize; ++i) {
+                size_t n = t * kHopSize + i;
+                frame_[i] = (n >= kPadSize && n - kPadSize < x.size()) ? x[n - kPadSize] : 0.0f;
+            }
+            ProcessFrame(frame_.data(), out.data() + f * kNumFreqs);
+            on_frame(t, std::span<const float>{spectrum_});
+        }
+    }
+
+    void Process(std::span<const float> x, std::span<float> out) {
+        Process(x, out, [](size_t, std::span<const float>) {});
+    }
+
+    /**
+     * @brief 最后一次ProcessFrame()的频谱, OourasRealFFT的输出格式, 乘过窗
+     */
+    std::span<const float> GetSpectrum() const noexcept {
+        return spectrum_;
+    }
+private:
+    spectral::OourasRealFFT fft_;
+    std::vector<float> window_;
+    std::vector<float> windowed_;
+    std::vector<float> spectrum_;
+    std::vector<float> frame_;
+};
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <span>
+#include <string_view>
+#include "swift_f0_weights.hpp"
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 推理前的静音/噪声门限, 可以从命令行设置
+ */
+struct GateConfig {
+    bool enabled{true};
+    // 帧的rms低于它就不推理, dBFS
+    float min_rms_db{-60.0f};
+    // 模型频带(kMinBin...kMaxBin)的功率谱平坦度高于它就不推理
+    // 白噪声的周期图平坦度约exp(-0.5772)=0.56, 谐波信号接近0
+    float max_flatness{0.45f};
+    // 门限判断为静音时仍然推理, 统计门限丢掉的有声帧, 用来调整上面两个参数
+    bool audit{false};
+
+    static constexpr const char* kUsage =
+        "  --gate=on|off\n"
+        "  --gate-min-rms-db=DB\n"
+        "  --gate-max-flatness=F\n"
+        "  --gate-audit=on|off\n";
+
+    /**
+     * @brief 解析一个"--key=value"参数
+     * @return false: 不是门限参数, 或者value不合法
+     */
+    bool ParseArgument(std::string_view arg) noexcept {
+        if (!arg.starts_with("--")) return false;
+        arg.remove_prefix(2);
+        auto eq = arg.find('=');
+        if (eq == std::string_view::npos) return false;
+        std::string_view key = arg.substr(0, eq);
+        std::string_view value = arg.substr(eq + 1);
+
+        if (key == "gate") return ParseBool(value, enabled);
+        if (key == "gate-min-rms-db") return ParseFloat(value, min_rms_db);
+        if (key == "gate-max-flatness") return ParseFloat(value, max_flatness);
+        if (key == "gate-audit") return ParseBool(value, audit);
+        return false;
+    }
+private:
+    static bool ParseFloat(std::string_view value, float& out) noexcept {
+        float v{};
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), v);
+        if (ec != std::errc{} || end != value.data() + value.size()) return false;
+        out = v;
+        return true;
+    }
+
+    static bool ParseBool(std::string_view value, bool& out) noexcept {
+        if (value == "on") out = true;
+        else if (value == "off") out = false;
+        else return false;
+        return true;
+    }
+};
+
+/**
+ * @brief 门限跳过的比例和丢掉的有声帧
+ *        只有推理过的帧知道不加门限时是不是有声, audit时所有帧都推理, recall才是准确的
+ */
+struct GateStats {
+    size_t num_frames{};
+    size_t num_skipped{};
+    // 推理过并且有声的帧
+    size_t num_voiced{};
+    // 推理过, 有声, 但是门限判断为静音的帧
+    size_t num_lost{};
+
+    /**
+     * @param skipped 门限判断为静音
+     * @param inferred 这一帧推理过
+     * @param voiced 推理结果是有声, inferred时才有意义
+     */
+    void Add(bool skipped, bool inferred, bool voiced) noexcept {
+        ++num_frames;
+        num_skipped += skipped;
+        if (inferred && voiced) {
+            ++num_voiced;
+            num_lost += skipped;
+        }
+    }
+
+    float SkippedFraction() const noexcept {
+        return num_frames == 0 ? 0.0f : static_cast<float>(num_skipped) / num_frames;
+    }
+
+    /**
+     * @brief 不加门限时有声的帧里, 被门限丢掉的比例
+     */
+    float RecallLost() const noexcept {
+        return num_voiced == 0 ? 0.0f : static_cast<float>(num_lost) / num_voiced;
+    }
+
+    void Print(const char* name, std::FILE* file = stdout) const {
+        std::fprintf(file, "%s: frames=%zu skipped=%.4f voiced=%zu lost=%zu recall_lost=%.4f\n",
+            name, num_frames, SkippedFraction(), num_voiced, num_lost, RecallLost());
+    }
+};
+
+/**
+ * @brief 用SwiftF0FrontEnd已经算好的加窗频谱判断一帧是否可以不推理, 不再做额外的FFT
+ *        rms: 由Parseval从整个频谱算, 除以窗的能量, 得到帧内的平均功率
+ *        平坦度: 模型频带内功率谱的几何平均/算术平均
+ */
+class SilenceGate {
+public:
+    using Weights = SwiftF0Weights;
+    static constexpr size_t kFFTSize = Weights::kFFTSize;
+
+    /**
+     * @param window SwiftF0FrontEnd::GetWindow()
+     */
+    void Init(std::span<const float> window, const GateConfig& config) noexcept {
+        config_ = config;
+        window_energy_ = 0;
+        for (float w : window) {
+            window_energy_ += w * w;
+        }
+    }
+
+    const GateConfig& GetConfig() const noexcept {
+        return config_;
+    }
+
+    /**
+     * @param spectrum SwiftF0FrontEnd::GetSpectrum()
+     * @return true: 这一帧当作无声, 不需要推理
+     */
+    bool IsSilent(std::span<const float> spectrum) const noexcept {
+        if (!config_.enabled) return false;
+        return RmsDb(spectrum) < config_.min_rms_db || Flatness(spectrum) > config_.max_flatness;
+    }
+
+    float RmsDb(std::span<const float> spectrum) const noexcept {
+        // 单边谱, 0和N/2只有一份
+        float energy = Power(spectrum, 0) + Power(spectrum, kFFTSize / 2);
+        for (size_t i = 1; i < kFFTSize / 2; ++i) {
+            energy += 2.0f * Power(spectrum, i);
+        }
+        float mean_power = energy / (kFFTSize * window_energy_);
+        return 10.0f * std::log10(mean_power + 1e-20f);
+    }
+
+    static float Flatness(std::span<const float> spectrum) noexcept {
+        float log_sum = 0;
+        float sum = 0;
+        for (size_t i = Weights::kMinBin; i < Weights::kMaxBin; ++i) {
+            float p = Power(spectrum, i) + 1e-20f;
+            log_sum += std::log(p);
+            sum += p;
+        }
+        constexpr float kNumBins = static_cast<float>(Weights::kMaxBin - Weights::kMinBin);
+        return std::exp(log_sum / kNumBins) / (sum / kNumBins);
+    }
+private:
+    static float Power(std::span<const float> spectrum, size_t bin) noexcept {
+        float re = spectrum[2 * bin];
+        float im = spectrum[2 * bin + 1];
+        return re * re + im * im;
+    }
+
+    GateConfig config_;
+    float window_energy_{1};
+};
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+#include "swift_f0_weights.hpp"
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <immintrin.h>
+#define SWIFT_F0_SIMD_AVX2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SWIFT_F0_SIMD_NEON 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SWIFT_F0_SIMD_SSE2 1
+#endif
+
+namespace qwqdsp::pitch::kernel {
+using Weights = SwiftF0Weights;
+
+constexpr size_t kNumFreqs = Weights::kNumFreqs;
+constexpr size_t kKernelSize = Weights::kKernelSize;
+constexpr size_t kHalfKernel = kKernelSize / 2;
+
+#if defined(SWIFT_F0_SIMD_AVX2)
+struct Vec {
+    static constexpr size_t kWidth = 8;
+    __m256 v;
+    static Vec Load(const float* p) noexcept { return {_mm256_loadu_ps(p)}; }
+    static Vec Broadcast(float x) noexcept { return {_mm256_set1_ps(x)}; }
+    static Vec MulAdd(Vec a, Vec b, Vec c) noexcept { return {_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+    static Vec Max(Vec a, Vec b) noexcept { return {_mm256_max_ps(a.v, b.v)}; }
+    void Store(float* p) const noexcept { _mm256_storeu_ps(p, v); }
+    float Sum() const noexcept {
+        __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+        x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+        return _mm_cvtss_f32(x);
+    }
+};
+#elif defined(SWIFT_F0_SIMD_NEON)
+struct Vec {
+    static constexpr size_t kWidth = 4;
+    float32x4_t v;
+    static Vec Load(const float* p) noexcept { return {vld1q_f32(p)}; }
+    static Vec Broadcast(float x) noexcept { return {vdupq_n_f32(x)}; }
+    static Vec MulAdd(Vec a, Vec b, Vec c) noexcept { return {vfmaq_f32(c.v, a.v, b.v)}; }
+    static Vec Max(Vec a, Vec b) noexcept { return {vmaxq_f32(a.v, b.v)}; }
+    void Store(float* p) const noexcept { vst1q_f32(p, v); }
+    float Sum() const noexcept { return vaddvq_f32(v); }
+};
+#elif defined(SWIFT_F0_SIMD_SSE2)
+struct Vec {
+    static constexpr size_t kWidth = 4;
+    __m128 v;
+    static Vec Load(const float* p) noexcept { return {_mm_loadu_ps(p)}; }
+    static Vec Broadcast(float x) noexcept { return {_mm_set1_ps(x)}; }
+    static Vec MulAdd(Vec a, Vec b, Vec c) noexcept { return {_mm_add_ps(_mm_mul_ps(a.v, b.v), c.v)}; }
+    static Vec Max(Vec a, Vec b) noexcept { return {_mm_max_ps(a.v, b.v)}; }
+    void Store(float* p) const noexcept { _mm_storeu_ps(p, v); }
+    float Sum() const noexcept {
+        __m128 x = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+        return _mm_cvtss_f32(x);
+    }
+};
+#else
+struct Vec {
+    static constexpr size_t kWidth = 1;
+    float v;
+    static Vec Load(const float* p) noexcept { return {*p}; }
+    static Vec Broadcast(float x) noexcept { return {x}; }
+    static Vec MulAdd(Vec a, Vec b, Vec c) noexcept { return {a.v * b.v + c.v}; }
+    static Vec Max(Vec a, Vec b) noexcept { return {std::max(a.v, b.v)}; }
+    void Store(float* p) const noexcept { *p = v; }
+    float Sum() const noexcept { return v; }
+};
+#endif
+
+/**
+ * @brief 展开固定次数的循环, 这样-O2下累加器也能留在寄存器里
+ * @tparam Func void(std::integral_constant<size_t, i>)
+ */
+template<size_t N, class Func>
+inline void Unroll(Func&& func) noexcept {
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        (func(std::integral_constant<size_t, I>{}), ...);
+    }(std::make_index_sequence<N>{});
+}
+
+// 卷积按8个频率一组计算, 多算的几个频率最后清0
+constexpr size_t kComputeFreqs = (kNumFreqs + 7) / 8 * 8;
+// 每个通道一行: [kHalfKernel个0][kNumFreqs][0...], 读取时最多越过kComputeFreqs + kKernelSize - 1
+constexpr size_t kStride = (kComputeFreqs + kKernelSize - 1 + 7) / 8 * 8;
+
+// 一次计算kCoBlock个输出通道, 它们共享输入的读取
+constexpr size_t kCoBlock = 4;
+
+/**
+ * @brief [out, in, kf, kt] -> [out/kCoBlock, in, kt, kf, kCoBlock], 让卷积内循环顺序读取权重
+ *        凑不满kCoBlock的输出通道单独排成[in, kt, kf]
+ */
+inline std::vector<float> PackConvWeight(const Weights::ConvLayer& layer) {
+    std::vector<float> packed;
+    packed.reserve(layer.weight.size());
+    auto at = [&](size_t co, size_t ci, size_t kt, size_t kf) {
+        return layer.weight[((co * layer.in_channels + ci) * kKernelSize + kf) * kKernelSize + kt];
+    };
+    size_t co = 0;
+    for (; co + kCoBlock <= layer.out_channels; co += kCoBlock) {
+        for (size_t ci = 0; ci < layer.in_channels; ++ci) {
+            for (size_t kt = 0; kt < kKernelSize; ++kt) {
+                for (size_t kf = 0; kf < kKernelSize; ++kf) {
+                    for (size_t j = 0; j < kCoBlock; ++j) {
+                        packed.push_back(at(co + j, ci, kt, kf));
+                    }
+                }
+            }
+        }
+    }
+    for (; co < layer.out_channels; ++co) {
+        for (size_t ci = 0; ci < layer.in_channels; ++ci) {
+            for (size_t kt = 0; kt < kKernelSize; ++kt) {
+                for (size_t kf = 0; kf < kKernelSize; ++kf) {
+                    packed.push_back(at(co, ci, kt, kf));
+                }
+            }
+        }
+    }
+    return packed;
+}
+
+/**
+ * @brief kCo个输出通道 x kF个向量宽的频率, 全部累加在寄存器里
+ */
+template<size_t kCo, size_t kF>
+inline void ConvTile(const float* const* cols, size_t in_channels, const float* weight,
+                     const float* bias, float* out, size_t f) noexcept {
+    Vec acc[kCo][kF];
+    Unroll<kCo>([&](auto c) {
+        Unroll<kF>([&](auto j) {
+            acc[c][j] = Vec::Broadcast(bias[c]);
+        });
+    });
+    for (size_t ci = 0; ci < in_channels; ++ci) {
+        for (size_t kt = 0; kt < kKernelSize; ++kt) {
+            const float* in = cols[kt] + ci * kStride + f;
+            Unroll<kKernelSize>([&](auto kf) {
+                Vec x[kF];
+                Unroll<kF>([&](auto j) {
+                    x[j] = Vec::Load(in + kf + j * Vec::kWidth);
+                });
+                Unroll<kCo>([&](auto c) {
+                    Vec w = Vec::Broadcast(weight[kf * kCo + c]);
+                    Unroll<kF>([&](auto j) {
+                        acc[c][j] = Vec::MulAdd(w, x[j], acc[c][j]);
+                    });
+                });
+            });
+            weight += kKernelSize * kCo;
+        }
+    }
+    const Vec zero = Vec::Broadcast(0.0f);
+    Unroll<kCo>([&](auto c) {
+        Unroll<kF>([&](auto j) {
+            Vec::Max(acc[c][j], zero).Store(out + c * kStride + kHalfKernel + f + j * Vec::kWidth);
+        });
+    });
+}
+
+template<size_t kCo>
+inline void ConvChannels(const float* const* cols, size_t in_channels, const float* weight,
+                         const float* bias, float* out) noexcept {
+    // AVX2有16个寄存器, kCo*kF个累加器加kF个输入
+    constexpr size_t kF = kCo == 1 ? 4 : 3;
+    size_t f = 0;
+    for (; f + kF * Vec::kWidth <= kComputeFreqs; f += kF * Vec::kWidth) {
+        ConvTile<kCo, kF>(cols, in_channels, weight, bias, out, f);
+    }
+    for (; f < kComputeFreqs; f += Vec::kWidth) {
+        ConvTile<kCo, 1>(cols, in_channels, weight, bias, out, f);
+    }
+    for (size_t c = 0; c < kCo; ++c) {
+        float* dst = out + c * kStride + kHalfKernel;
+        std::fill(dst + kNumFreqs, dst + kComputeFreqs, 0.0f);
+    }
+}
+
+/**
+ * @brief Conv(5x5, SAME) + Relu, 计算一个时间列
+ * @param cols kKernelSize个相邻时间的输入列, 每列[in_channels][kStride]
+ * @param weight PackConvWeight()的结果
+ * @param out [out_channels][kStride]
+ */
+inline void ConvColumn(const float* const* cols, size_t in_channels,
+                       const float* weight, const float* bias, size_t out_channels,
+                       float* out) noexcept {
+    const size_t weight_size = in_channels * kKernelSize * kKernelSize;
+    size_t co = 0;
+    for (; co + kCoBlock <= out_channels; co += kCoBlock) {
+        ConvChannels<kCoBlock>(cols, in_channels, weight + co * weight_size, bias + co, out + co * kStride);
+    }
+    for (; co < out_channels; ++co) {
+        ConvChannels<1>(cols, in_channels, weight + co * weight_size, bias + co, out + co * kStride);
+    }
+}
+
+inline float Dot(const float* a, const float* b, size_t n) noexcept {
+    const size_t vec_end = n - n % Vec::kWidth;
+    Vec acc = Vec::Broadcast(0.0f);
+    for (size_t i = 0; i < vec_end; i += Vec::kWidth) {
+        acc = Vec::MulAdd(Vec::Load(a + i), Vec::Load(b + i), acc);
+    }
+    float sum = acc.Sum();
+    for (size_t i = vec_end; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief freq_projection -> Softmax -> 峰值附近加权平均
+ * @param x 最后一层卷积的输出, kNumFreqs个
+ * @param logits kNumPitchBins个, 临时空间
+ */
+inline void Decode(const float* x, const Weights& weights, std::span<float> logits,
+                   float& pitch, float& confidence) noexcept {
+    constexpr size_t kNumPitchBins = Weights::kNumPitchBins;
+    for (size_t i = 0; i < kNumPitchBins; ++i) {
+        logits[i] = weights.projection_bias[i]
+            + Dot(weights.projection_weight.data() + i * kNumFreqs, x, kNumFreqs);
+    }
+
+    float max_logit = *std::max_element(logits.begin(), logits.end());
+    float sum = 0;
+    for (auto& v : logits) {
+        v = std::exp(v - max_logit);
+        sum += v;
+    }
+    float gain = 1.0f / sum;
+    for (auto& v : logits) {
+        v *= gain;
+    }
+
+    int peak = static_cast<int>(std::max_element(logits.begin(), logits.end()) - logits.begin());
+    int begin = std::max(0, peak - Weights::kDecodeRadius);
+    int end = std::min(static_cast<int>(kNumPitchBins) - 1, peak + Weights::kDecodeRadius);
+    confidence = 0;
+    float weighted = 0;
+    for (int i = begin; i <= end; ++i) {
+        confidence += logits[i];
+        weighted += logits[i] * weights.pitch_bin_centers[i];
+    }
+    pitch = weighted / (confidence + Weights::kDecodeEpsilon);
+}
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 纳秒的对数直方图, 每个2倍区间分8个桶, 误差不超过12.5%, 最大值是精确的
+ *        只能有一个线程Record(), 其他线程随时可以读, 读到的是近似的快照
+ */
+class LatencyHistogram {
+public:
+    static constexpr size_t kSubBits = 3;
+    static constexpr size_t kNumSub = size_t{1} << kSubBits;
+    static constexpr size_t kNumBuckets = (64 - kSubBits + 1) * kNumSub;
+
+    static int64_t NowNs() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Record(int64_t ns) noexcept {
+        const uint64_t v = static_cast<uint64_t>(std::max<int64_t>(ns, 0));
+        Increment(counts_[BucketIndex(v)]);
+        Increment(count_);
+        if (v > max_.load(std::memory_order_relaxed)) {
+            max_.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t GetCount() const noexcept {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t GetMax() const noexcept {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @param q 0...1
+     * @return 第q分位所在的桶的上界, 不超过最大值
+     */
+    uint64_t Percentile(double q) const noexcept {
+        const uint64_t count = GetCount();
+        if (count == 0) return 0;
+        const uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+        uint64_t sum = 0;
+        for (size_t i = 0; i < kNumBuckets; ++i) {
+            sum += counts_[i].load(std::memory_order_relaxed);
+            if (sum >= target) {
+                return std::min(BucketUpper(i), GetMax());
+            }
+        }
+        return GetMax();
+    }
+private:
+    // 小于kNumSub的值一个值一个桶, 之后每个2倍区间kNumSub个桶
+    static size_t BucketIndex(uint64_t v) noexcept {
+        if (v < kNumSub) return static_cast<size_t>(v);
+        const size_t octave = static_cast<size_t>(std::bit_width(v)) - 1;
+        const size_t sub = static_cast<size_t>(v >> (octave - kSubBits)) & (kNumSub - 1);
+        return (octave - kSubBits + 1) * kNumSub + sub;
+    }
+
+    static uint64_t BucketUpper(size_t index) noexcept {
+        if (index < kNumSub) return index;
+        const size_t octave = index / kNumSub + kSubBits - 1;
+        const uint64_t sub = index % kNumSub;
+        const uint64_t lower = (kNumSub + sub) << (octave - kSubBits);
+        return lower + (uint64_t{1} << (octave - kSubBits)) - 1;
+    }
+
+    // 只有一个线程写, 不需要fetch_add
+    static void Increment(std::atomic<uint64_t>& a) noexcept {
+        a.store(a.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, kNumBuckets> counts_{};
+    std::atomic<uint64_t> count_{};
+    std::atomic<uint64_t> max_{};
+};
+
+/**
+ * @brief realtime每个hop各阶段的耗时
+ *        采集回调 -> 分析线程取到hop -> 推理开始 -> 推理结束 -> 画图/输出线程取到结果
+ */
+struct LatencyStats {
+    enum Stage {
+        // 音频回调凑齐hop到分析线程取到它, 在audio_ring里等待
+        kQueue,
+        // front end和门限
+        kFrontEnd,
+        // 模型和Viterbi, 门限跳过的hop不计
+        kInference,
+        // 推理结束到画图或者无窗口模式的输出线程取到结果
+        kPublish,
+        // 音频回调到取到结果
+        kTotal,
+        kNumStages
+    };
+    static constexpr const char* kNames[kNumStages]{"queue", "front_end", "inference", "publish", "total"};
+
+    std::array<LatencyHistogram, kNumStages> stages;
+
+    /**
+     * @brief 一行一个阶段, p50/p99/max, 毫秒
+     */
+    int Format(Stage stage, char* line, size_t size) const noexcept {
+        const LatencyHistogram& h = stages[stage];
+        return std::snprintf(line, size, "%-9s p50 %7.3fms p99 %7.3fms max %7.3fms n=%llu",
+            kNames[stage], h.Percentile(0.5) * 1e-6, h.Percentile(0.99) * 1e-6, h.GetMax() * 1e-6,
+            static_cast<unsigned long long>(h.GetCount()));
+    }
+
+    void Print(std::FILE* file = stdout) const {
+        char line[128];
+        for (size_t i = 0; i < kNumStages; ++i) {
+            Format(static_cast<Stage>(i), line, sizeof(line));
+            std::fprintf(file, "latency %s\n", line);
+        }
+    }
+};
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "swift_f0_frontend.hpp"
+#include "swift_f0_kernels.hpp"
+#include "swift_f0_weights.hpp"
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 不依赖onnxruntime的SwiftF0, 权重直接从model.onnx读取
+ *        逐层计算整个时间轴, 单线程, 卷积使用swift_f0_kernels.hpp里的SIMD实现
+ */
+class NativePitchDetector {
+public:
+    using Weights = SwiftF0Weights;
+    static constexpr size_t kFFTSize = Weights::kFFTSize;
+    static constexpr size_t kHopSize = Weights::kHopSize;
+    static constexpr size_t kPadSize = Weights::kPadSize;
+    static constexpr size_t kNumFreqs = Weights::kNumFreqs;
+    static constexpr size_t kNumPitchBins = Weights::kNumPitchBins;
+    static constexpr size_t kStride = kernel::kStride;
+    static constexpr size_t kKernelSize = kernel::kKernelSize;
+    static constexpr size_t kHalfKernel = kernel::kHalfKernel;
+
+    static constexpr size_t NumFrames(size_t num_samples) noexcept {
+        if (num_samples + 2 * kPadSize < kFFTSize) return 0;
+        return (num_samples + 2 * kPadSize - kFFTSize) / kHopSize + 1;
+    }
+
+    bool Init(const std::filesystem::path& model_path) {
+        Weights weights;
+        if (!weights.Load(model_path)) return false;
+        Init(weights);
+        return true;
+    }
+
+    void Init(const Weights& weights) {
+        front_end_.Init(weights.window);
+        weights_ = weights;
+        packed_weights_.clear();
+        for (const auto& layer : weights_.conv_layers) {
+            packed_weights_.push_back(kernel::PackConvWeight(layer));
+        }
+        frame_.resize(kFFTSize);
+    }
+
+    /**
+     * @brief 和session.Run({batch_size, x.size() / batch_size})一样的结果, 每一路依次计算
+     *        和PitchDetector一样, batch_size为0或者x.size()不能整除时抛出std::invalid_argument
+     */
+    void Process(std::span<const float> x, size_t batch_size = 1) {
+        if (batch_size == 0 || x.size() % batch_size != 0) {
+            throw std::invalid_argument{"input size is not a multiple of batch_size"};
+        }
+        const size_t num_samples = x.size() / batch_size;
+        Resize(NumFrames(num_samples), batch_size);
+        for (size_t b = 0; b < batch_size; ++b) {
+            LoadAudio(x.subspan(b * num_samples, num_samples));
+            ProcessRow(b * num_frames_);
+        }
+    }
+
+    /**
+     * @brief 输入SwiftF0FrontEnd算好的log|STFT|, 跳过STFT
+     * @param x [batch_size][time_frames][kNumFreqs], 不是batch_size * kNumFreqs的倍数时抛出std::invalid_argument
+     */
+    void ProcessLogMagnitude(std::span<const float> x, size_t batch_size = 1) {
+        if (batch_size == 0 || x.size() % (batch_size * kNumFreqs) != 0) {
+            throw std::invalid_argument{"input size is not a multiple of batch_size * kNumFreqs"};
+        }
+        const size_t row_size = x.size() / batch_size;
+        Resize(row_size / kNumFreqs, batch_size);
+        for (size_t b = 0; b < batch_size; ++b) {
+            LoadLogMagnitude(x.subspan(b * row_size, row_size));
+            ProcessRow(b * num_frames_);
+        }
+    }
+
+    /**
+     * @return [batch_size][GetNumFrames()]
+     */
+    std::span<const float> GetPitch() const noexcept {
+        return pitch_;
+    }
+
+    std::span<const float> GetConfidence() const noexcept {
+        return confidence_;
+    }
+
+    /**
+     * @return 模型的softmax, [batch_size][GetNumFrames()][kNumPitchBins], 给StreamingViterbi用
+     */
+    std::span<const float> GetProbabilities() const noexcept {
+        return probabilities_;
+    }
+
+    /**
+     * @brief 每一路输出的帧数
+     */
+    size_t GetNumFrames() const noexcept {
+        return num_frames_;
+    }
+private:
+    void Resize(size_t num_frames, size_t batch_size) {
+        num_frames_ = num_frames;
+        pitch_.resize(batch_size * num_frames_);
+        confidence_.resize(batch_size * num_frames_);
+        probabilities_.resize(batch_size * num_frames_ * kNumPitchBins);
+        // [num_frames + 2 * kHalfKernel][channels][kStride], 时间和频率两边都是0
+        input_.assign((num_frames_ + 2 * kHalfKernel) * kStride, 0.0f);
+    }
+
+    float* InputColumn(size_t t) noexcept {
+        return input_.data() + (t + kHalfKernel) * kStride + kHalfKernel;
+    }
+
+    void LoadAudio(std::span<const float> x) noexcept {
+        for (size_t t = 0; t < num_frames_; ++t) {
+            for (size_t i = 0; i < kFFTSize; ++i) {
+                // 模型在两端补了kPadSize个0
+                size_t n = t * kHopSize + i;
+                frame_[i] = (n >= kPadSize && n - kPadSize < x.size()) ? x[n - kPadSize] : 0.0f;
+            }
+            front_end_.ProcessFrame(frame_.data(), InputColumn(t));
+        }
+    }
+
+    void LoadLogMagnitude(std::span<const float> x) noexcept {
+        for (size_t t = 0; t < num_frames_; ++t) {
+            std::copy_n(x.begin() + t * kNumFreqs, kNumFreqs, InputColumn(t));
+        }
+    }
+
+    void ProcessRow(size_t output_offset) {
+        const size_t num_frames = num_frames_;
+        if (num_frames == 0) return;
+        const size_t num_rows = num_frames + 2 * kHalfKernel;
+
+        for (size_t l = 0; l < weights_.conv_layers.size(); ++l) {
+            const auto& layer = weights_.conv_layers[l];
+            const size_t in_size = layer.in_channels * kStride;
+            const size_t out_size = layer.out_channels * kStride;
+            output_.assign(num_rows * out_size, 0.0f);
+            for (size_t t = 0; t < num_frames; ++t) {
+                const float* cols[kKernelSize];
+                for (size_t kt = 0; kt < kKernelSize; ++kt) {
+                    cols[kt] = input_.data() + (t + kt) * in_size;
+                }
+                kernel::ConvColumn(cols, layer.in_channels, packed_weights_[l].data(), layer.bias.data(),
+                                   layer.out_channels, output_.data() + (t + kHalfKernel) * out_size);
+            }
+            std::swap(input_, output_);
+        }
+
+        for (size_t t = 0; t < num_frames; ++t) {
+            const float* column = input_.data() + (t + kHalfKernel) * kStride + kHalfKernel;
+            std::span<float> probabilities{probabilities_.data() + (output_offset + t) * kNumPitchBins, kNumPitchBins};
+            kernel::Decode(column, weights_, probabilities, pitch_[output_offset + t], confidence_[output_offset + t]);
+        }
+    }
+
+    SwiftF0FrontEnd front_end_;
+    Weights weights_;
+    std::vector<std::vector<float>> packed_weights_;
+
+    std::vector<float> frame_;
+    std::vector<float> input_;
+    std::vector<float> output_;
+    size_t num_frames_{};
+    std::vector<float> pitch_;
+    std::vector<float> confidence_;
+    std::vector<float> probabilities_;
+};
+}
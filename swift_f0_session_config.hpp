@@ -0,0 +1,118 @@
+#pragma once
+#include <charconv>
+#include <string_view>
+#include <onnxruntime_cxx_api.h>
+#include <onnxruntime_session_options_config_keys.h>
+
+namespace qwqdsp::pitch {
+/**
+ * @brief onnxruntime会话的调优参数, 可以从命令行设置, 创建会话时转换成Ort::SessionOptions
+ *        0/kDefault表示保持onnxruntime的默认值
+ */
+struct SessionConfig {
+    enum class Switch {
+        kDefault,
+        kOn,
+        kOff
+    };
+
+    GraphOptimizationLevel graph_optimization_level{GraphOptimizationLevel::ORT_ENABLE_ALL};
+    int intra_op_threads{};
+    int inter_op_threads{};
+    // 并行执行只有在graph有分支的时候才有用, SwiftF0是一条直线
+    bool parallel_execution{false};
+    Switch mem_pattern{Switch::kDefault};
+    Switch cpu_arena{Switch::kDefault};
+    // 线程池在任务之间空转等待, 延迟低但是会占满核
+    Switch intra_op_spinning{Switch::kDefault};
+    Switch inter_op_spinning{Switch::kDefault};
+    // PitchDetector把优化后的模型缓存成ORT格式写在模型旁边, 启动时跳过解析和大部分图优化
+    bool model_cache{false};
+
+    static constexpr const char* kUsage =
+        "  --graph-opt=disable|basic|extended|all\n"
+        "  --intra-op-threads=N\n"
+        "  --inter-op-threads=N\n"
+        "  --execution=sequential|parallel\n"
+        "  --mem-pattern=on|off\n"
+        "  --cpu-arena=on|off\n"
+        "  --intra-op-spinning=on|off\n"
+        "  --inter-op-spinning=on|off\n"
+        "  --model-cache=on|off\n";
+
+    Ort::SessionOptions MakeSessionOptions() const {
+        Ort::SessionOptions options;
+        options.SetGraphOptimizationLevel(graph_optimization_level);
+        if (intra_op_threads > 0) options.SetIntraOpNumThreads(intra_op_threads);
+        if (inter_op_threads > 0) options.SetInterOpNumThreads(inter_op_threads);
+        options.SetExecutionMode(parallel_execution ? ExecutionMode::ORT_PARALLEL : ExecutionMode::ORT_SEQUENTIAL);
+        if (mem_pattern == Switch::kOn) options.EnableMemPattern();
+        if (mem_pattern == Switch::kOff) options.DisableMemPattern();
+        if (cpu_arena == Switch::kOn) options.EnableCpuMemArena();
+        if (cpu_arena == Switch::kOff) options.DisableCpuMemArena();
+        if (intra_op_spinning != Switch::kDefault) {
+            options.AddConfigEntry(kOrtSessionOptionsConfigAllowIntraOpSpinning, intra_op_spinning == Switch::kOn ? "1" : "0");
+        }
+        if (inter_op_spinning != Switch::kDefault) {
+            options.AddConfigEntry(kOrtSessionOptionsConfigAllowInterOpSpinning, inter_op_spinning == Switch::kOn ? "1" : "0");
+        }
+        return options;
+    }
+
+    /**
+     * @brief 解析一个"--key=value"参数
+     * @return false: 不是会话参数, 或者value不合法
+     */
+    bool ParseArgument(std::string_view arg) noexcept {
+        if (!arg.starts_with("--")) return false;
+        arg.remove_prefix(2);
+        auto eq = arg.find('=');
+        if (eq == std::string_view::npos) return false;
+        std::string_view key = arg.substr(0, eq);
+        std::string_view value = arg.substr(eq + 1);
+
+        if (key == "graph-opt") {
+            if (value == "disable") graph_optimization_level = GraphOptimizationLevel::ORT_DISABLE_ALL;
+            else if (value == "basic") graph_optimization_level = GraphOptimizationLevel::ORT_ENABLE_BASIC;
+            else if (value == "extended") graph_optimization_level = GraphOptimizationLevel::ORT_ENABLE_EXTENDED;
+            else if (value == "all") graph_optimization_level = GraphOptimizationLevel::ORT_ENABLE_ALL;
+            else return false;
+            return true;
+        }
+        if (key == "intra-op-threads") return ParseInt(value, intra_op_threads);
+        if (key == "inter-op-threads") return ParseInt(value, inter_op_threads);
+        if (key == "execution") {
+            if (value == "sequential") parallel_execution = false;
+            else if (value == "parallel") parallel_execution = true;
+            else return false;
+            return true;
+        }
+        if (key == "mem-pattern") return ParseSwitch(value, mem_pattern);
+        if (key == "cpu-arena") return ParseSwitch(value, cpu_arena);
+        if (key == "intra-op-spinning") return ParseSwitch(value, intra_op_spinning);
+        if (key == "inter-op-spinning") return ParseSwitch(value, inter_op_spinning);
+        if (key == "model-cache") {
+            if (value == "on") model_cache = true;
+            else if (value == "off") model_cache = false;
+            else return false;
+            return true;
+        }
+        return false;
+    }
+private:
+    static bool ParseInt(std::string_view value, int& out) noexcept {
+        int v{};
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), v);
+        if (ec != std::errc{} || end != value.data() + value.size() || v < 0) return false;
+        out = v;
+        return true;
+    }
+
+    static bool ParseSwitch(std::string_view value, Switch& out) noexcept {
+        if (value == "on") out = Switch::kOn;
+        else if (value == "off") out = Switch::kOff;
+        else return false;
+        return true;
+    }
+};
+}
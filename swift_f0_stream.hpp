@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <vector>
+#include "swift_f0_frontend.hpp"
+#include "swift_f0_kernels.hpp"
+#include "swift_f0_weights.hpp"
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 流式SwiftF0
+ *        每个hop只计算最新的一列stft, 以及每一层卷积因此能算出的那一列输出
+ *        每层卷积保留最近kKernelSize列输入作为历史, 时间方向上的SAME padding用0历史/Flush()补0实现
+ *        所以输出和把整段音频送进session.Run的结果一致, 但每层卷积会带来(kKernelSize-1)/2帧的延迟
+ */
+class StreamingPitchDetector {
+public:
+    using Weights = SwiftF0Weights;
+    static constexpr size_t kFFTSize = Weights::kFFTSize;
+    static constexpr size_t kHopSize = Weights::kHopSize;
+    static constexpr size_t kKernelSize = kernel::kKernelSize;
+    static constexpr size_t kHalfKernel = kernel::kHalfKernel;
+    static constexpr size_t kStride = kernel::kStride;
+
+    bool Init(const std::filesystem::path& model_path) {
+        Weights weights;
+        if (!weights.Load(model_path)) return false;
+        Init(weights);
+        return true;
+    }
+
+    void Init(const Weights& weights) {
+        front_end_.Init(weights.window);
+        weights_ = weights;
+
+        layers_.clear();
+        size_t max_channels = 1;
+        for (const auto& w : weights.conv_layers) {
+            Layer& layer = layers_.emplace_back();
+            layer.in_channels = w.in_channels;
+            layer.out_channels = w.out_channels;
+            layer.weight = kernel::PackConvWeight(w);
+            layer.bias = w.bias;
+            layer.history.resize(kKernelSize * w.in_channels * kStride);
+            layer.output.resize(w.out_channels * kStride);
+            max_channels = std::max(max_channels, w.in_channels);
+        }
+        // 卷积权重已经打包到layers_里了
+        weights_.conv_layers.clear();
+        zeros_.assign(max_channels * kStride, 0.0f);
+        frame_.resize(kFFTSize);
+        column_.resize(kStride);
+        logits_.resize(Weights::kNumPitchBins);
+        Reset();
+    }
+
+    void Reset() noexcept {
+        // 模型在音频前面补了kPadSize个0
+        std::fill(frame_.begin(), frame_.end(), 0.0f);
+        num_filled_ = Weights::kPadSize;
+        std::fill(column_.begin(), column_.end(), 0.0f);
+        for (auto& layer : layers_) {
+            std::fill(layer.history.begin(), layer.history.end(), 0.0f);
+            std::fill(layer.output.begin(), layer.output.end(), 0.0f);
+            layer.num_inputs = 0;
+        }
+    }
+
+    /**
+     * @brief 从输入的stft帧到输出之间的帧延迟
+     */
+    size_t GetLatencyFrames() const noexcept {
+        return layers_.size() * kHalfKernel;
+    }
+
+    /**
+     * @brief 从输出帧窗口的中心到它被输出时最后一个输入采样的距离
+     */
+    size_t GetLatencySamples() const noexcept {
+        return GetLatencyFrames() * kHopSize + kFFTSize / 2;
+    }
+
+    /**
+     * @tparam Func void(size_t frame, float pitch, float confidence)
+     *         frame和session.Run输出的帧下标一致, 在on_frame里可以用GetProbabilities()拿到这一帧的softmax
+     */
+    template<class Func>
+    void Process(std::span<const float> x, Func&& on_frame) {
+        while (!x.empty()) {
+            size_t n = std::min(x.size(), kFFTSize - num_filled_);
+            std::copy_n(x.begin(), n, frame_.begin() + num_filled_);
+            num_filled_ += n;
+            x = x.subspan(n);
+            if (num_filled_ == kFFTSize) {
+                ProcessFrame(on_frame);
+            }
+        }
+    }
+
+    /**
+     * @brief 最近一次输出的那一帧模型的softmax, kNumPitchBins个, 给StreamingViterbi用
+     */
+    std::span<const float> GetProbabilities() const noexcept {
+        return logits_;
+    }
+
+    /**
+     * @brief 补上模型结尾的padding, 输出剩下的帧, 然后Reset()
+     */
+    template<class Func>
+    void Flush(Func&& on_frame) {
+        size_t pad = Weights::kPadSize;
+        while (pad != 0) {
+            size_t n = std::min(pad, kFFTSize - num_filled_);
+            std::fill_n(frame_.begin() + num_filled_, n, 0.0f);
+            num_filled_ += n;
+            pad -= n;
+            if (num_filled_ == kFFTSize) {
+                ProcessFrame(on_frame);
+            }
+        }
+        // 每一层的时间方向SAME padding, 必须在上一层全部输出之后才补
+        for (size_t i = 0; i < layers_.size(); ++i) {
+            for (size_t k = 0; k < kHalfKernel; ++k) {
+                PushColumn(i, zeros_.data(), on_frame);
+            }
+        }
+        Reset();
+    }
+private:
+    struct Layer {
+        size_t in_channels{};
+        size_t out_channels{};
+        std::vector<float> weight;
+        std::vector<float> bias;
+        // [kKernelSize][in_channels][kStride], 环形
+        std::vector<float> history;
+        // [out_channels][kStride]
+        std::vector<float> output;
+        size_t num_inputs{};
+
+        const float* Column(size_t t) const noexcept {
+            return history.data() + (t % kKernelSize) * in_channels * kStride;
+        }
+
+        /**
+         * @return 是否产生了新的一列输出
+         */
+        bool Push(const float* column) noexcept {
+            std::copy_n(column, in_channels * kStride, history.data() + (num_inputs % kKernelSize) * in_channels * kStride);
+            ++num_inputs;
+            if (num_inputs <= kHalfKernel) return false;
+
+            // 输出时刻 t = num_inputs - 1 - kHalfKernel, 需要的输入是 t-kHalfKernel ... t+kHalfKernel
+            // 负时刻的历史从来没有写过, 一直是0
+            const size_t newest = num_inputs - 1 + kKernelSize;
+            const float* cols[kKernelSize];
+            for (size_t kt = 0; kt < kKernelSize; ++kt) {
+                cols[kt] = Column(newest - (kKernelSize - 1) + kt);
+            }
+            kernel::ConvColumn(cols, in_channels, weight.data(), bias.data(), out_channels, output.data());
+            return true;
+        }
+    };
+
+    template<class Func>
+    void ProcessFrame(Func& on_frame) {
+        front_end_.ProcessFrame(frame_.data(), column_.data() + kHalfKernel);
+        PushColumn(0, column_.data(), on_frame);
+
+        std::copy(frame_.begin() + kHopSize, frame_.end(), frame_.begin());
+        num_filled_ -= kHopSize;
+    }
+
+    template<class Func>
+    void PushColumn(size_t layer_idx, const float* column, Func& on_frame) {
+        Layer& layer = layers_[layer_idx];
+        if (!layer.Push(column)) return;
+
+        if (layer_idx + 1 < layers_.size()) {
+            PushColumn(layer_idx + 1, layer.output.data(), on_frame);
+            return;
+        }
+
+        size_t frame = layer.num_inputs - 1 - kHalfKernel;
+        float pitch{};
+        float confidence{};
+        kernel::Decode(layer.output.data() + kHalfKernel, weights_, logits_, pitch, confidence);
+        on_frame(frame, pitch, confidence);
+    }
+
+    SwiftF0FrontEnd front_end_;
+    Weights weights_;
+    std::vector<Layer> layers_;
+
+    std::vector<float> frame_;
+    size_t num_filled_{};
+    std::vector<float> column_;
+    std::vector<float> zeros_;
+    std::vector<float> logits_;
+};
+}
@@ -0,0 +1,235 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+#include "swift_f0_weights.hpp"
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 在模型的kNumPitchBins个音高bin加一个无声状态上做固定延迟的Viterbi
+ *        每输入一帧softmax, 输出lag帧之前那一帧的判决, 和看到lag帧未来的完整Viterbi一样平滑
+ *        音高只能在band个bin以内跳动, 每帧O(kNumPitchBins * band)
+ *        回溯表是[lag + 1][状态数]的环, Init()之后Push()/Flush()不分配内存
+ *
+ *        分数不是归一化的概率, 而是和模型的decode对齐:
+ *        bin i的分数是它附近±kDecodeRadius的概率和(模型的confidence) * p[i] / max(p), 峰值处就是confidence
+ *        无声的分数是(1 - confidence) * t / (1 - t), confidence = voiced_threshold时两者相等
+ *        转移: 音高每跳一个bin乘一个三角形的权重, 有声/无声切换乘switch_probability
+ */
+class StreamingViterbi {
+public:
+    using Weights = SwiftF0Weights;
+    static constexpr size_t kNumPitchBins = Weights::kNumPitchBins;
+    static constexpr size_t kUnvoiced = kNumPitchBins;
+    static constexpr size_t kNumStates = kNumPitchBins + 1;
+
+    struct Config {
+        // 输出比输入晚多少帧
+        size_t lag{8};
+        // 相邻两帧之间音高最多跳多少个bin, 一个bin是33音分
+        size_t band{12};
+        // 有声/无声切换的代价
+        float switch_probability{0.02f};
+        // 没有前后帧的影响时, confidence超过它判为有声, 和main.cpp的kConfidence一样
+        float voiced_threshold{0.9f};
+    };
+
+    /**
+     * @param bin_centers SwiftF0Weights::pitch_bin_centers
+     */
+    void Init(std::span<const float> bin_centers, const Config& config) {
+        config_ = config;
+        config_.band = std::clamp<size_t>(config_.band, 1, kNumPitchBins - 1);
+        bin_centers_.assign(bin_centers.begin(), bin_centers.end());
+
+        // 三角形的转移, 不跳是1, 跳得越远越低
+        const size_t band = config_.band;
+        log_transition_.resize(band + 1);
+        for (size_t d = 0; d <= band; ++d) {
+            log_transition_[d] = std::log((1.0f - config_.switch_probability) * (band + 1 - d) / (band + 1));
+        }
+        log_stay_unvoiced_ = std::log(1.0f - config_.switch_probability);
+        log_to_unvoiced_ = std::log(config_.switch_probability);
+        log_to_voiced_ = std::log(config_.switch_probability);
+        const float threshold = std::clamp(config_.voiced_threshold, 1e-3f, 1.0f - 1e-3f);
+        log_unvoiced_gain_ = std::log(threshold / (1.0f - threshold));
+
+        const size_t depth = config_.lag + 1;
+        delta_.resize(kNumStates);
+        next_delta_.resize(kNumStates);
+        log_emission_.resize(kNumStates);
+        back_pointer_.resize(depth * kNumStates);
+        probabilities_.resize(depth * kNumPitchBins);
+        path_.resize(depth);
+        Reset();
+    }
+
+    void Reset() noexcept {
+        // 从无声开始
+        std::fill(delta_.begin(), delta_.end(), -std::numeric_limits<float>::infinity());
+        delta_[kUnvoiced] = 0;
+        num_frames_ = 0;
+        num_output_ = 0;
+    }
+
+    size_t GetLatencyFrames() const noexcept {
+        return config_.lag;
+    }
+
+    /**
+     * @param probabilities 一帧模型的softmax, kNumPitchBins个
+     * @tparam Func void(size_t frame, float pitch, float confidence), pitch=0是无声
+     */
+    template<class Func>
+    void Push(std::span<const float> probabilities, Func&& on_frame) {
+        float* slot = Slot(num_frames_);
+        std::copy_n(probabilities.begin(), kNumPitchBins, slot);
+        const size_t peak = static_cast<size_t>(std::max_element(slot, slot + kNumPitchBins) - slot);
+        const float gain = 1.0f / (slot[peak] + 1e-30f);
+        // 每个bin附近±kDecodeRadius的和, 滑动窗口
+        float local = 0;
+        for (size_t i = 0; i < std::min<size_t>(Weights::kDecodeRadius, kNumPitchBins); ++i) {
+            local += slot[i];
+        }
+        float max_local = 0;
+        for (size_t i = 0; i < kNumPitchBins; ++i) {
+            if (i + Weights::kDecodeRadius < kNumPitchBins) local += slot[i + Weights::kDecodeRadius];
+            if (i > static_cast<size_t>(Weights::kDecodeRadius)) local -= slot[i - Weights::kDecodeRadius - 1];
+            log_emission_[i] = std::log(local * slot[i] * gain + 1e-30f);
+            if (i == peak) max_local = local;
+        }
+        const float confidence = std::clamp(max_local, 1e-6f, 1.0f - 1e-6f);
+        log_emission_[kUnvoiced] = std::log(1.0f - confidence) + log_unvoiced_gain_;
+        Step(on_frame);
+    }
+
+    /**
+     * @brief 没有推理的帧, 比如被SilenceGate跳过的, 当作一定是无声
+     */
+    template<class Func>
+    void PushUnvoiced(Func&& on_frame) {
+        std::fill_n(Slot(num_frames_), kNumPitchBins, 0.0f);
+        std::fill_n(log_emission_.begin(), kNumPitchBins, -std::numeric_limits<float>::infinity());
+        log_emission_[kUnvoiced] = 0;
+        Step(on_frame);
+    }
+
+    /**
+     * @brief 输出还在延迟里的帧, 然后Reset()
+     */
+    template<class Func>
+    void Flush(Func&& on_frame) {
+        if (num_frames_ > num_output_) {
+            Backtrack(num_frames_ - num_output_);
+            for (size_t t = num_output_; t < num_frames_; ++t) {
+                Output(t, path_[t - num_output_], on_frame);
+            }
+        }
+        Reset();
+    }
+private:
+    template<class Func>
+    void Step(Func& on_frame) {
+        const size_t band = config_.band;
+        int16_t* back = back_pointer_.data() + (num_frames_ % (config_.lag + 1)) * kNumStates;
+        const float from_unvoiced = delta_[kUnvoiced] + log_to_voiced_;
+        float best_voiced = -std::numeric_limits<float>::infinity();
+        size_t best_voiced_state = 0;
+        for (size_t j = 0; j < kNumPitchBins; ++j) {
+            float best = from_unvoiced;
+            size_t best_state = kUnvoiced;
+            const size_t begin = j > band ? j - band : 0;
+            const size_t end = std::min(j + band, kNumPitchBins - 1);
+            for (size_t i = begin; i <= end; ++i) {
+                float v = delta_[i] + log_transition_[i > j ? i - j : j - i];
+                if (v > best) {
+                    best = v;
+                    best_state = i;
+                }
+            }
+            next_delta_[j] = best + log_emission_[j];
+            back[j] = static_cast<int16_t>(best_state);
+            if (delta_[j] > best_voiced) {
+                best_voiced = delta_[j];
+                best_voiced_state = j;
+            }
+        }
+        const float stay = delta_[kUnvoiced] + log_stay_unvoiced_;
+        const float leave = best_voiced + log_to_unvoiced_;
+        next_delta_[kUnvoiced] = std::max(stay, leave) + log_emission_[kUnvoiced];
+        back[kUnvoiced] = static_cast<int16_t>(stay >= leave ? kUnvoiced : best_voiced_state);
+
+        // 防止一直累加下溢
+        const float max_delta = *std::max_element(next_delta_.begin(), next_delta_.end());
+        for (size_t j = 0; j < kNumStates; ++j) {
+            delta_[j] = next_delta_[j] - max_delta;
+        }
+        ++num_frames_;
+
+        if (num_frames_ > config_.lag) {
+            Backtrack(config_.lag + 1);
+            Output(num_output_, path_[0], on_frame);
+            ++num_output_;
+        }
+    }
+
+    /**
+     * @brief 从最新一帧的最优状态回溯, path_[0...count)是最近count帧的状态, 最早的在前
+     */
+    void Backtrack(size_t count) noexcept {
+        size_t state = static_cast<size_t>(std::max_element(delta_.begin(), delta_.end()) - delta_.begin());
+        for (size_t k = count; k-- > 0;) {
+            path_[k] = state;
+            const size_t frame = num_frames_ - count + k;
+            state = static_cast<size_t>(back_pointer_[(frame % (config_.lag + 1)) * kNumStates + state]);
+        }
+    }
+
+    template<class Func>
+    void Output(size_t frame, size_t state, Func& on_frame) {
+        if (state == kUnvoiced) {
+            on_frame(frame, 0.0f, 0.0f);
+            return;
+        }
+        // 和模型一样在选中的bin附近加权平均, 得到比bin更细的音高
+        const float* slot = Slot(frame);
+        const size_t begin = state > static_cast<size_t>(Weights::kDecodeRadius) ? state - Weights::kDecodeRadius : 0;
+        const size_t end = std::min(state + Weights::kDecodeRadius, kNumPitchBins - 1);
+        float confidence = 0;
+        float weighted = 0;
+        for (size_t i = begin; i <= end; ++i) {
+            confidence += slot[i];
+            weighted += slot[i] * bin_centers_[i];
+        }
+        float pitch = confidence > Weights::kDecodeEpsilon ? weighted / confidence : bin_centers_[state];
+        on_frame(frame, pitch, confidence);
+    }
+
+    float* Slot(size_t frame) noexcept {
+        return probabilities_.data() + (frame % (config_.lag + 1)) * kNumPitchBins;
+    }
+
+    Config config_;
+    std::vector<float> bin_centers_;
+    std::vector<float> log_transition_;
+    float log_stay_unvoiced_{};
+    float log_to_unvoiced_{};
+    float log_to_voiced_{};
+    float log_unvoiced_gain_{};
+
+    std::vector<float> delta_;
+    std::vector<float> next_delta_;
+    std::vector<float> log_emission_;
+    // [lag + 1][kNumStates], 环形
+    std::vector<int16_t> back_pointer_;
+    // [lag + 1][kNumPitchBins], 环形, 输出时在选中的bin附近加权平均
+    std::vector<float> probabilities_;
+    std::vector<size_t> path_;
+    size_t num_frames_{};
+    size_t num_output_{};
+};
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "onnx_proto.hpp"
+
+namespace qwqdsp::pitch {
+/**
+ * @brief 从model.onnx里读出SwiftF0的权重
+ *        只实现了读取initializer和node需要的那一点protobuf
+ *        graph: Pad -> STFT -> |X| -> Slice -> Log -> conv_layers.*(Conv+Relu) -> freq_projection -> Softmax
+ */
+class SwiftF0Weights {
+public:
+    // 这些常数写在graph的Constant里, 不是initializer
+    static constexpr size_t kFFTSize = 1024;
+    static constexpr size_t kHopSize = 256;
+    static constexpr size_t kPadSize = 384;
+    static constexpr size_t kMinBin = 3;
+    static constexpr size_t kMaxBin = 135;
+    static constexpr size_t kNumFreqs = kMaxBin - kMinBin;
+    static constexpr float kLogEpsilon = 1e-8f;
+    static constexpr size_t kKernelSize = 5;
+    static constexpr size_t kNumPitchBins = 200;
+    static constexpr int kDecodeRadius = 9;
+    static constexpr float kDecodeEpsilon = 1e-7f;
+
+    struct ConvLayer {
+        size_t in_channels{};
+        size_t out_channels{};
+        // [out_channels, in_channels, kKernelSize(freq), kKernelSize(time)]
+        std::vector<float> weight;
+        std::vector<float> bias;
+    };
+
+    bool Load(const std::filesystem::path& path) {
+        std::string bytes;
+        if (!onnx::ReadFile(path, bytes)) return false;
+        return Parse(bytes);
+    }
+
+    bool Parse(std::string_view model) {
+        initializers_.clear();
+        conv_layers.clear();
+
+        std::string_view graph;
+        onnx::ProtoReader reader{model};
+        while (reader.Next()) {
+            if (reader.field == 7) graph = reader.bytes;
+        }
+        if (graph.empty()) return false;
+
+        // initializer在node后面, 先把node收集起来
+        std::vector<std::string_view> nodes;
+        reader = onnx::ProtoReader{graph};
+        while (reader.Next()) {
+            if (reader.field == 1) nodes.push_back(reader.bytes);
+            else if (reader.field == 5) ParseTensor(reader.bytes);
+        }
+
+        for (auto node : nodes) {
+            std::string_view op_type;
+            std::vector<std::string_view> inputs;
+            onnx::ProtoReader r{node};
+            while (r.Next()) {
+                if (r.field == 1) inputs.push_back(r.bytes);
+                else if (r.field == 4) op_type = r.bytes;
+            }
+
+            if (op_type == "STFT" && inputs.size() > 2) {
+                if (!Take(inputs[2], window)) return false;
+            }
+            else if (op_type == "Conv" && inputs.size() > 2) {
+                auto it = initializers_.find(std::string{inputs[1]});
+                if (it == initializers_.end()) return false;
+                auto& dims = it->second.dims;
+                if (dims.size() == 4) {
+                    ConvLayer layer;
+                    layer.out_channels = static_cast<size_t>(dims[0]);
+                    layer.in_channels = static_cast<size_t>(dims[1]);
+                    if (!Take(inputs[1], layer.weight) || !Take(inputs[2], layer.bias)) return false;
+                    conv_layers.push_back(std::move(layer));
+                }
+                else {
+                    // freq_projection, 1x1 Conv1D
+                    if (!Take(inputs[1], projection_weight) || !Take(inputs[2], projection_bias)) return false;
+                }
+            }
+        }
+        if (!Take("pitch_bin_centers", pitch_bin_centers)) return false;
+        initializers_.clear();
+
+        return window.size() == kFFTSize
+            && !conv_layers.empty()
+            && conv_layers.front().in_channels == 1
+            && conv_layers.back().out_channels == 1
+            && projection_weight.size() == kNumPitchBins * kNumFreqs
+            && projection_bias.size() == kNumPitchBins
+            && pitch_bin_centers.size() == kNumPitchBins;
+    }
+
+    std::vector<float> window;
+    std::vector<ConvLayer> conv_layers;
+    // [kNumPitchBins, kNumFreqs]
+    std::vector<float> projection_weight;
+    std::vector<float> projection_bias;
+    std::vector<float> pitch_bin_centers;
+private:
+    struct Tensor {
+        std::vector<int64_t> dims;
+        std::vector<float> data;
+    };
+
+    void ParseTensor(std::string_view proto) {
+        constexpr uint64_t kFloat = 1;
+        Tensor tensor;
+        uint64_t data_type{};
+        std::string_view name;
+        std::string_view raw;
+        onnx::ProtoReader r{proto};
+        while (r.Next()) {
+            switch (r.field) {
+            case 1:
+                if (r.wire_type == 0) {
+                    tensor.dims.push_back(static_cast<int64_t>(r.value));
+                }
+                else {
+                    onnx::ProtoReader packed{r.bytes};
+                    uint64_t v;
+                    while (packed.pos < packed.buffer.size() && packed.Varint(v)) {
+                        tensor.dims.push_back(static_cast<int64_t>(v));
+                    }
+                }
+                break;
+            case 2:
+                data_type = r.value;
+                break;
+            case 4:
+                // float_data, 一般是packed
+                if (r.wire_type == 2) {
+                    size_t n = r.bytes.size() / sizeof(float);
+                    size_t offset = tensor.data.size();
+                    tensor.data.resize(offset + n);
+                    std::memcpy(tensor.data.data() + offset, r.bytes.data(), n * sizeof(float));
+                }
+                else if (r.wire_type == 5) {
+                    float v;
+                    std::memcpy(&v, r.bytes.data(), sizeof(float));
+                    tensor.data.push_back(v);
+                }
+                break;
+            case 8:
+                name = r.bytes;
+                break;
+            case 9:
+                raw = r.bytes;
+                break;
+            }
+        }
+        if (data_type != kFloat) return;
+        if (!raw.empty()) {
+            // onnx的raw_data固定是小端
+            tensor.data.resize(raw.size() / sizeof(float));
+            std::memcpy(tensor.data.data(), raw.data(), tensor.data.size() * sizeof(float));
+        }
+        initializers_[std::string{name}] = std::move(tensor);
+    }
+
+    bool Take(std::string_view name, std::vector<float>& out) {
+        auto it = initializers_.find(std::string{name});
+        if (it == initializers_.end()) return false;
+        out = it->second.data;
+        return true;
+    }
+
+    std::unordered_map<std::string, Tensor> initializers_;
+};
+}